@@ -0,0 +1,202 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file ArrayPacker.cc
+ */
+
+#include "ArrayPacker.hh"
+
+#include "File.hh"
+#include "ImageBuilder.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Candidate image.
+ */
+struct Source
+{
+  string    name;  ///< Path relative to the source directory.
+  ImageData image; ///< Decoded pixels, empty if too large or failed to load.
+};
+
+static string groupName(const ImageData& image)
+{
+  // Only MBM normal maps are flagged when loaded, others are detected by pixels.
+  bool        isNormal = (image.flags & ImageData::NORMAL_BIT) || image.isNormalMap();
+  const char* type     = isNormal ? "nm" : image.flags & ImageData::ALPHA_BIT ? "rgba" : "rgb";
+  char        name[64];
+
+  snprintf(name, sizeof(name), "array_%dx%d_%s", image.width, image.height, type);
+  return name;
+}
+
+static bool writeIndex(const string& file, const vector<Source*>& slices)
+{
+  FILE* f = fopen(file.c_str(), "w");
+  if (f == nullptr) {
+    printf("Failed to open for writing '%s'.\n", file.c_str());
+    return false;
+  }
+
+  for (size_t i = 0; i < slices.size(); ++i) {
+    fprintf(f, "%d %s\n", int(i), slices[i]->name.c_str());
+  }
+
+  if (fclose(f) != 0) {
+    printf("Failed to write '%s'.\n", file.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool packArray(const string& destBase, const vector<Source*>& slices, int options,
+                      double scale, int nThreads)
+{
+  vector<ImageData> faces;
+
+  for (Source* slice : slices) {
+    faces.push_back(move(slice->image));
+  }
+
+  options  = ImageBuilder::optionsFor(faces[0], options);
+  options &= ~ImageBuilder::CUBE_MAP_BIT;
+
+  DDSData dds;
+  string  destFile = destBase + ".dds";
+
+  if (!ImageBuilder::prepareDDS(faces.data(), int(faces.size()), options, scale, &dds)) {
+    return false;
+  }
+
+  // Source pixels are not needed any more while compressing.
+  faces.clear();
+
+  ImageBuilder::compressDDS(&dds, nThreads);
+
+  return ImageBuilder::writeDDS(dds, destFile.c_str()) && writeIndex(destBase + ".txt", slices);
+}
+
+bool ArrayPacker::pack(const char* dir, const char* destDir, int options, double scale,
+                       int nThreads)
+{
+  if (!File::isDirectory(dir)) {
+    printf("Not a directory '%s'.\n", dir);
+    return false;
+  }
+
+  vector<string> files;
+  vector<Source> sources;
+
+  File::listRecursively(dir, &files);
+
+  for (const string& file : files) {
+    if (File::isImage(file.c_str()) && !ImageBuilder::isDDSFile(file.c_str())) {
+      sources.push_back(Source());
+      sources.back().name = file;
+    }
+  }
+
+  // Images are loaded in parallel, sizes are checked from headers first so that large images
+  // are never decoded.
+  atomic<size_t> next(0);
+  vector<thread> threads;
+
+  for (int i = 0; i < max(nThreads, 1); ++i) {
+    threads.emplace_back([&]
+    {
+      for (size_t j = next++; j < sources.size(); j = next++) {
+        string path = string(dir) + "/" + sources[j].name;
+        int    width, height;
+
+        if (ImageBuilder::readSize(path.c_str(), &width, &height) &&
+            width <= MAX_SIZE && height <= MAX_SIZE)
+        {
+          sources[j].image = ImageBuilder::loadImage(path.c_str());
+        }
+      }
+    });
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+
+  map<string, vector<Source*>> groups;
+
+  for (Source& source : sources) {
+    if (!source.image.isEmpty()) {
+      groups[groupName(source.image)].push_back(&source);
+    }
+  }
+
+  int nPacked = 0;
+  int nArrays = 0;
+  int nFailed = 0;
+
+  for (const auto& group : groups) {
+    const vector<Source*>& members = group.second;
+
+    if (members.size() < 2) {
+      continue;
+    }
+
+    // Chunks are of equal size, so each holds at least `MAX_SLICES / 2` slices and remains an
+    // array.
+    size_t nChunks = (members.size() + MAX_SLICES - 1) / MAX_SLICES;
+
+    for (size_t i = 0; i < nChunks; ++i) {
+      auto   begin    = members.begin() + ptrdiff_t(i * members.size() / nChunks);
+      auto   end      = members.begin() + ptrdiff_t((i + 1) * members.size() / nChunks);
+      string destBase = string(destDir) + "/" + group.first;
+
+      if (nChunks > 1) {
+        destBase += "_" + to_string(i);
+      }
+
+      if (packArray(destBase, vector<Source*>(begin, end), options, scale, nThreads)) {
+        nPacked += int(end - begin);
+        ++nArrays;
+      }
+      else {
+        ++nFailed;
+      }
+    }
+  }
+
+  printf("Packed %d of %d images into %d arrays", nPacked, int(sources.size()), nArrays);
+
+  if (nFailed != 0) {
+    printf(", %d failed", nFailed);
+  }
+  printf(".\n");
+
+  return nFailed == 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file ArrayPacker.hh
+ *
+ * `ArrayPacker` class.
+ */
+
+#pragma once
+
+/**
+ * Packs many small images (icons, decals) into DDS texture arrays.
+ *
+ * Images from a directory tree are grouped by dimensions and by alpha class (opaque, transparent or
+ * normal map), so that all slices of an array share the same format. Every group of at least two
+ * images becomes one or more arrays `array_<w>x<h>_<class>[_<n>].dds` (named by source dimensions,
+ * also when scaled), each with a sidecar text file of the same name that lists `<slice> <image>`
+ * lines, image paths being relative to the source directory.
+ */
+class ArrayPacker
+{
+public:
+
+  /// Images larger than this in either dimension are not packed.
+  static const int MAX_SIZE = 256;
+
+  /// Largest number of slices in one array, bigger groups are split into equal arrays.
+  static const int MAX_SLICES = 256;
+
+public:
+
+  /**
+   * Forbid instances.
+   */
+  ArrayPacker() = delete;
+
+  /**
+   * Pack images from `dir` into arrays written to `destDir`.
+   *
+   * Images are decoded and array slices compressed on `nThreads` threads. `options` and `scale`
+   * are applied like to single images, except that cube maps are not possible.
+   *
+   * @return true iff all arrays were written.
+   */
+  static bool pack(const char* dir, const char* destDir, int options, double scale,
+                   int nThreads);
+
+};
@@ -0,0 +1,666 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file BC7Encoder.cc
+ *
+ * Block layout follows the BC7 format specification (D3D11 functional specification, section
+ * 19.5.13). Only single-subset modes are used, so no partition tables are needed.
+ */
+
+#include "BC7Encoder.hh"
+
+#include "Kernels.hh"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define KERNEL static inline __attribute__((always_inline))
+
+#if defined(__i386__) || defined(__x86_64__)
+# define HAS_X86_VARIANTS
+#endif
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * Block pixels, channels in separate arrays so the index search vectorises over pixels.
+ */
+struct Pixels
+{
+  int32_t c[4][16];
+};
+
+/**
+ * Mode 6 encoding: 7-bit RGBA endpoints with a p-bit each and 4-bit indices.
+ */
+struct Mode6
+{
+  int     q[2][4];
+  int     p[2];
+  uint8_t indices[16];
+  int     error;
+};
+
+/**
+ * Mode 5 encoding: 7-bit RGB and 8-bit alpha endpoints, 2-bit colour and alpha indices, alpha
+ * swapped with one of RGB channels if `rotation` is non-zero.
+ */
+struct Mode5
+{
+  int     rotation;
+  int     colour[2][3];
+  int     alpha[2];
+  uint8_t colourIndices[16];
+  uint8_t alphaIndices[16];
+  int     error;
+};
+
+/**
+ * Little-endian bit stream writer for a 128-bit block.
+ */
+struct BitWriter
+{
+  uint8_t* block;
+  int      pos = 0;
+
+  explicit BitWriter(uint8_t* block_) :
+    block(block_)
+  {
+    memset(block, 0, 16);
+  }
+
+  void put(int value, int nBits)
+  {
+    for (int i = 0; i < nBits; ++i, ++pos) {
+      block[pos / 8] = uint8_t(block[pos / 8] | ((value >> i) & 1) << (pos % 8));
+    }
+  }
+};
+
+}
+
+static const int WEIGHTS_2[4]  = { 0, 21, 43, 64 };
+static const int WEIGHTS_4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static const int32_t RGBA_CHANNELS[4]  = { 1, 1, 1, 1 };
+static const int32_t RGB_CHANNELS[4]   = { 1, 1, 1, 0 };
+static const int32_t ALPHA_CHANNEL[4]  = { 0, 0, 0, 1 };
+
+/*
+ * Index search: for each pixel the nearest palette entry over channels with non-zero weight.
+ */
+
+KERNEL int selectIndicesBody(const Pixels& pixels, const int32_t (*palette)[4], int nEntries,
+                             const int32_t* weights, uint8_t* indices)
+{
+  int32_t best[16];
+  int32_t bestIndex[16];
+
+  for (int i = 0; i < 16; ++i) {
+    best[i]      = INT_MAX;
+    bestIndex[i] = 0;
+  }
+
+  for (int j = 0; j < nEntries; ++j) {
+    for (int i = 0; i < 16; ++i) {
+      int32_t d0    = pixels.c[0][i] - palette[j][0];
+      int32_t d1    = pixels.c[1][i] - palette[j][1];
+      int32_t d2    = pixels.c[2][i] - palette[j][2];
+      int32_t d3    = pixels.c[3][i] - palette[j][3];
+      int32_t error = weights[0] * d0 * d0 + weights[1] * d1 * d1 + weights[2] * d2 * d2 +
+                      weights[3] * d3 * d3;
+      bool    isBetter = error < best[i];
+
+      best[i]      = isBetter ? error : best[i];
+      bestIndex[i] = isBetter ? j : bestIndex[i];
+    }
+  }
+
+  int error = 0;
+
+  for (int i = 0; i < 16; ++i) {
+    error     += best[i];
+    indices[i] = uint8_t(bestIndex[i]);
+  }
+  return error;
+}
+
+typedef int SelectIndices(const Pixels&, const int32_t (*)[4], int, const int32_t*, uint8_t*);
+
+#define DEFINE_VARIANT(NS, TARGET) \
+  namespace NS \
+  { \
+    TARGET static int selectIndices(const Pixels& pixels, const int32_t (*palette)[4], \
+                                    int nEntries, const int32_t* weights, uint8_t* indices) \
+    { \
+      return selectIndicesBody(pixels, palette, nEntries, weights, indices); \
+    } \
+  }
+
+DEFINE_VARIANT(baseline, )
+
+#ifdef HAS_X86_VARIANTS
+DEFINE_VARIANT(avx2, __attribute__((target("avx2"))))
+DEFINE_VARIANT(avx512, __attribute__((target("avx512f,avx512bw"))))
+#endif
+
+// Variant matching the one chosen by `Kernels::select()`, which is called before any encoding.
+static SelectIndices* selectIndices()
+{
+#ifdef HAS_X86_VARIANTS
+  static SelectIndices* const variant =
+    strcmp(Kernels::selected(), "avx512") == 0 ? avx512::selectIndices :
+    strcmp(Kernels::selected(), "avx2") == 0   ? avx2::selectIndices : baseline::selectIndices;
+
+  return variant;
+#else
+  return baseline::selectIndices;
+#endif
+}
+
+/*
+ * Endpoint fitting, in floating point and only compiled for the baseline instruction set.
+ */
+
+static inline int interpolate(int e0, int e1, int weight)
+{
+  return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+static inline int clampByte(float value)
+{
+  return min(max(int(lround(value)), 0), 255);
+}
+
+// Endpoints of the principal axis through given channels, spanning all pixels.
+static void fitPrincipal(const Pixels& pixels, int firstChannel, int nChannels, float (*e)[4])
+{
+  float mean[4] = {};
+
+  for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+    for (int i = 0; i < 16; ++i) {
+      mean[k] += float(pixels.c[k][i]);
+    }
+    mean[k] /= 16.0f;
+  }
+
+  float cov[4][4] = {};
+
+  for (int i = 0; i < 16; ++i) {
+    for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+      for (int l = firstChannel; l < firstChannel + nChannels; ++l) {
+        cov[k][l] += (float(pixels.c[k][i]) - mean[k]) * (float(pixels.c[l][i]) - mean[l]);
+      }
+    }
+  }
+
+  // Power iteration, starting from the diagonal of the covariance matrix.
+  float axis[4] = {};
+
+  for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+    axis[k] = cov[k][k] + 1.0f;
+  }
+
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[4] = {};
+    float length  = 0.0f;
+
+    for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+      for (int l = firstChannel; l < firstChannel + nChannels; ++l) {
+        next[k] += cov[k][l] * axis[l];
+      }
+      length = max(length, fabs(next[k]));
+    }
+    if (length < 1e-6f) {
+      break;
+    }
+    for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+      axis[k] = next[k] / length;
+    }
+  }
+
+  float lengthSq = 0.0f;
+
+  for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+    lengthSq += axis[k] * axis[k];
+  }
+
+  float minT = 0.0f;
+  float maxT = 0.0f;
+
+  for (int i = 0; i < 16 && lengthSq > 0.0f; ++i) {
+    float t = 0.0f;
+
+    for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+      t += (float(pixels.c[k][i]) - mean[k]) * axis[k];
+    }
+    t /= lengthSq;
+
+    minT = min(minT, t);
+    maxT = max(maxT, t);
+  }
+
+  for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+    e[0][k] = min(max(mean[k] + minT * axis[k], 0.0f), 255.0f);
+    e[1][k] = min(max(mean[k] + maxT * axis[k], 0.0f), 255.0f);
+  }
+}
+
+// Least-squares endpoints for given indices. Returns false if indices don't determine them.
+static bool fitLeastSquares(const Pixels& pixels, const uint8_t* indices, const int* weights,
+                            int firstChannel, int nChannels, float (*e)[4])
+{
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ax[4] = {}, bx[4] = {};
+
+  for (int i = 0; i < 16; ++i) {
+    float b = float(weights[indices[i]]) / 64.0f;
+    float a = 1.0f - b;
+
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+
+    for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+      ax[k] += a * float(pixels.c[k][i]);
+      bx[k] += b * float(pixels.c[k][i]);
+    }
+  }
+
+  float det = aa * bb - ab * ab;
+
+  if (fabs(det) < 1e-4f) {
+    return false;
+  }
+
+  for (int k = firstChannel; k < firstChannel + nChannels; ++k) {
+    e[0][k] = min(max((bb * ax[k] - ab * bx[k]) / det, 0.0f), 255.0f);
+    e[1][k] = min(max((aa * bx[k] - ab * ax[k]) / det, 0.0f), 255.0f);
+  }
+  return true;
+}
+
+/*
+ * Mode 6.
+ */
+
+static void evaluate(const Pixels& pixels, Mode6* mode)
+{
+  int32_t palette[16][4];
+
+  for (int k = 0; k < 4; ++k) {
+    int e0 = mode->q[0][k] << 1 | mode->p[0];
+    int e1 = mode->q[1][k] << 1 | mode->p[1];
+
+    for (int j = 0; j < 16; ++j) {
+      palette[j][k] = interpolate(e0, e1, WEIGHTS_4[j]);
+    }
+  }
+
+  mode->error = selectIndices()(pixels, palette, 16, RGBA_CHANNELS, mode->indices);
+}
+
+static void quantise(const float (*e)[4], int p0, int p1, Mode6* mode)
+{
+  mode->p[0] = p0;
+  mode->p[1] = p1;
+
+  for (int k = 0; k < 4; ++k) {
+    mode->q[0][k] = min(max(int(lround((e[0][k] - float(p0)) / 2.0f)), 0), 127);
+    mode->q[1][k] = min(max(int(lround((e[1][k] - float(p1)) / 2.0f)), 0), 127);
+  }
+}
+
+// Quantise endpoints and keep the result if it is better than `best`.
+static void tryEndpoints(const Pixels& pixels, const float (*e)[4], int speed, Mode6* best)
+{
+  Mode6 mode;
+
+  if (speed == BC7Encoder::FAST) {
+    // P-bit that matches endpoint brightness best.
+    int p[2];
+
+    for (int i = 0; i < 2; ++i) {
+      float sum = e[i][0] + e[i][1] + e[i][2] + e[i][3];
+      p[i] = int(lround(sum / 4.0f)) & 1;
+    }
+
+    quantise(e, p[0], p[1], &mode);
+    evaluate(pixels, &mode);
+
+    if (mode.error < best->error) {
+      *best = mode;
+    }
+    return;
+  }
+
+  for (int p = 0; p < 4; ++p) {
+    quantise(e, p & 1, p >> 1, &mode);
+    evaluate(pixels, &mode);
+
+    if (mode.error < best->error) {
+      *best = mode;
+    }
+  }
+}
+
+static void encodeMode6(const Pixels& pixels, int speed, Mode6* best)
+{
+  float e[2][4];
+
+  best->error = INT_MAX;
+
+  fitPrincipal(pixels, 0, 4, e);
+  tryEndpoints(pixels, e, speed, best);
+
+  int nIterations = speed + 1;
+
+  for (int i = 0; i < nIterations && best->error != 0; ++i) {
+    if (!fitLeastSquares(pixels, best->indices, WEIGHTS_4, 0, 4, e)) {
+      break;
+    }
+    tryEndpoints(pixels, e, speed, best);
+  }
+
+  if (speed < BC7Encoder::BEST) {
+    return;
+  }
+
+  // Greedy search of neighbouring quantised endpoints.
+  for (bool isImproved = true; isImproved && best->error != 0;) {
+    isImproved = false;
+
+    for (int i = 0; i < 8; ++i) {
+      for (int delta = -1; delta <= 1; delta += 2) {
+        Mode6 mode  = *best;
+        int&  value = mode.q[i / 4][i % 4];
+
+        value += delta;
+
+        if (0 <= value && value <= 127) {
+          evaluate(pixels, &mode);
+
+          if (mode.error < best->error) {
+            *best      = mode;
+            isImproved = true;
+          }
+        }
+      }
+    }
+  }
+}
+
+static void packMode6(Mode6 mode, uint8_t* block)
+{
+  // Index of the first pixel must have its highest bit clear, which is achieved by swapping.
+  if (mode.indices[0] & 8) {
+    swap(mode.q[0], mode.q[1]);
+    swap(mode.p[0], mode.p[1]);
+
+    for (uint8_t& index : mode.indices) {
+      index = uint8_t(15 - index);
+    }
+  }
+
+  BitWriter bits(block);
+
+  bits.put(1 << 6, 7);
+
+  for (int k = 0; k < 4; ++k) {
+    bits.put(mode.q[0][k], 7);
+    bits.put(mode.q[1][k], 7);
+  }
+
+  bits.put(mode.p[0], 1);
+  bits.put(mode.p[1], 1);
+  bits.put(mode.indices[0], 3);
+
+  for (int i = 1; i < 16; ++i) {
+    bits.put(mode.indices[i], 4);
+  }
+}
+
+/*
+ * Mode 5.
+ */
+
+static inline int unquantise7(int value)
+{
+  return value << 1 | value >> 6;
+}
+
+static int evaluateColour(const Pixels& pixels, const int (*colour)[3], uint8_t* indices)
+{
+  int32_t palette[4][4] = {};
+
+  for (int k = 0; k < 3; ++k) {
+    for (int j = 0; j < 4; ++j) {
+      palette[j][k] = interpolate(unquantise7(colour[0][k]), unquantise7(colour[1][k]),
+                                  WEIGHTS_2[j]);
+    }
+  }
+  return selectIndices()(pixels, palette, 4, RGB_CHANNELS, indices);
+}
+
+static int evaluateAlpha(const Pixels& pixels, const int* alpha, uint8_t* indices)
+{
+  int32_t palette[4][4] = {};
+
+  for (int j = 0; j < 4; ++j) {
+    palette[j][3] = interpolate(alpha[0], alpha[1], WEIGHTS_2[j]);
+  }
+  return selectIndices()(pixels, palette, 4, ALPHA_CHANNEL, indices);
+}
+
+static void encodeMode5(const Pixels& source, int rotation, int speed, Mode5* mode)
+{
+  Pixels pixels = source;
+
+  if (rotation != 0) {
+    swap(pixels.c[rotation - 1], pixels.c[3]);
+  }
+
+  mode->rotation = rotation;
+
+  // Colour endpoints.
+  float e[2][4];
+  int   colourError = INT_MAX;
+
+  fitPrincipal(pixels, 0, 3, e);
+
+  for (int i = 0; i <= speed; ++i) {
+    int     colour[2][3];
+    uint8_t indices[16];
+
+    for (int k = 0; k < 3; ++k) {
+      colour[0][k] = min(max(int(lround(e[0][k] * 127.0f / 255.0f)), 0), 127);
+      colour[1][k] = min(max(int(lround(e[1][k] * 127.0f / 255.0f)), 0), 127);
+    }
+
+    int error = evaluateColour(pixels, colour, indices);
+
+    if (error < colourError) {
+      colourError = error;
+      memcpy(mode->colour, colour, sizeof(colour));
+      memcpy(mode->colourIndices, indices, sizeof(indices));
+    }
+    if (colourError == 0 || !fitLeastSquares(pixels, mode->colourIndices, WEIGHTS_2, 0, 3, e)) {
+      break;
+    }
+  }
+
+  // Alpha endpoints, from range and then refined.
+  int alphaError = INT_MAX;
+
+  e[0][3] = float(*min_element(pixels.c[3], pixels.c[3] + 16));
+  e[1][3] = float(*max_element(pixels.c[3], pixels.c[3] + 16));
+
+  for (int i = 0; i < 2; ++i) {
+    int     alpha[2] = { clampByte(e[0][3]), clampByte(e[1][3]) };
+    uint8_t indices[16];
+    int     error = evaluateAlpha(pixels, alpha, indices);
+
+    if (error < alphaError) {
+      alphaError = error;
+      memcpy(mode->alpha, alpha, sizeof(alpha));
+      memcpy(mode->alphaIndices, indices, sizeof(indices));
+    }
+    if (alphaError == 0 || !fitLeastSquares(pixels, mode->alphaIndices, WEIGHTS_2, 3, 1, e)) {
+      break;
+    }
+  }
+
+  mode->error = colourError + alphaError;
+}
+
+static void packMode5(Mode5 mode, uint8_t* block)
+{
+  if (mode.colourIndices[0] & 2) {
+    swap(mode.colour[0], mode.colour[1]);
+
+    for (uint8_t& index : mode.colourIndices) {
+      index = uint8_t(3 - index);
+    }
+  }
+  if (mode.alphaIndices[0] & 2) {
+    swap(mode.alpha[0], mode.alpha[1]);
+
+    for (uint8_t& index : mode.alphaIndices) {
+      index = uint8_t(3 - index);
+    }
+  }
+
+  BitWriter bits(block);
+
+  bits.put(1 << 5, 6);
+  bits.put(mode.rotation, 2);
+
+  for (int k = 0; k < 3; ++k) {
+    bits.put(mode.colour[0][k], 7);
+    bits.put(mode.colour[1][k], 7);
+  }
+
+  bits.put(mode.alpha[0], 8);
+  bits.put(mode.alpha[1], 8);
+
+  bits.put(mode.colourIndices[0], 1);
+  for (int i = 1; i < 16; ++i) {
+    bits.put(mode.colourIndices[i], 2);
+  }
+
+  bits.put(mode.alphaIndices[0], 1);
+  for (int i = 1; i < 16; ++i) {
+    bits.put(mode.alphaIndices[i], 2);
+  }
+}
+
+BC7Encoder::BC7Encoder(int speed_, int nThreads_) :
+  speed(min(max(speed_, int(FAST)), int(BEST))), nThreads(max(nThreads_, 1))
+{}
+
+void BC7Encoder::compress(const uint8_t* rgba, int width, int height, void* blocks) const
+{
+  int nBlockRows    = (height + 3) / 4;
+  int nBlockColumns = (width + 3) / 4;
+  int nWorkers      = min(nThreads, nBlockRows);
+
+  auto encodeRows = [&](int firstRow, int endRow)
+  {
+    uint8_t* block = static_cast<uint8_t*>(blocks) + firstRow * nBlockColumns * 16;
+
+    for (int y = firstRow * 4; y < endRow * 4; y += 4) {
+      for (int x = 0; x < width; x += 4) {
+        uint8_t pixels[64];
+
+        // Pixels outside the image repeat the edge, they are never sampled.
+        for (int i = 0; i < 16; ++i) {
+          int sx = min(x + i % 4, width - 1);
+          int sy = min(y + i / 4, height - 1);
+
+          memcpy(pixels + i * 4, rgba + (sy * width + sx) * 4, 4);
+        }
+
+        encodeBlock(pixels, speed, block);
+        block += 16;
+      }
+    }
+  };
+
+  if (nWorkers <= 1) {
+    encodeRows(0, nBlockRows);
+    return;
+  }
+
+  vector<thread> threads;
+
+  for (int i = 0; i < nWorkers; ++i) {
+    threads.emplace_back(encodeRows, nBlockRows * i / nWorkers, nBlockRows * (i + 1) / nWorkers);
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+}
+
+void BC7Encoder::encodeBlock(const uint8_t* rgba, int speed, uint8_t* block)
+{
+  Pixels pixels;
+  bool   hasAlpha = false;
+
+  for (int i = 0; i < 16; ++i) {
+    for (int k = 0; k < 4; ++k) {
+      pixels.c[k][i] = rgba[i * 4 + k];
+    }
+    hasAlpha |= rgba[i * 4 + 3] != 255;
+  }
+
+  Mode6 mode6;
+  encodeMode6(pixels, speed, &mode6);
+
+  if (hasAlpha && speed != FAST && mode6.error != 0) {
+    Mode5 best;
+    best.error = INT_MAX;
+
+    for (int rotation = 0; rotation < 4; ++rotation) {
+      Mode5 mode5;
+      encodeMode5(pixels, rotation, speed, &mode5);
+
+      if (mode5.error < best.error) {
+        best = mode5;
+      }
+    }
+
+    if (best.error < mode6.error) {
+      packMode5(best, block);
+      return;
+    }
+  }
+
+  packMode6(mode6, block);
+}
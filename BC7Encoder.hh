@@ -0,0 +1,79 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file BC7Encoder.hh
+ *
+ * `BC7Encoder` class.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * BC7 block compressor.
+ *
+ * Blocks are encoded either in mode 6 (RGBA endpoints, 16 interpolation steps) or, for blocks with
+ * varying alpha, in mode 5 (separate RGB and alpha endpoints with channel rotation), whichever
+ * gives the lower error. Endpoints are fitted along the principal axis and refined by least
+ * squares. The innermost loop, choosing palette indices for pixels, uses integer arithmetic and is
+ * compiled for several instruction sets like `Kernels`, so the output is the same on every CPU.
+ *
+ * Image rows of blocks are split between threads.
+ */
+class BC7Encoder
+{
+public:
+
+  /// Fastest speed level, mode 6 only with a single refinement.
+  static const int FAST = 0;
+
+  /// Default speed level, all p-bit combinations, mode 5 for blocks with alpha.
+  static const int NORMAL = 1;
+
+  /// Slowest speed level, additional endpoint perturbation search.
+  static const int BEST = 2;
+
+private:
+
+  int speed;
+  int nThreads;
+
+public:
+
+  /**
+   * Create encoder with a speed level (`FAST`, `NORMAL` or `BEST`) and number of threads.
+   */
+  explicit BC7Encoder(int speed, int nThreads = 1);
+
+  /**
+   * Compress an RGBA image into 16-byte blocks, in the same order as `squish::CompressImage()`.
+   */
+  void compress(const uint8_t* rgba, int width, int height, void* blocks) const;
+
+  /**
+   * Compress a single 4x4 block of RGBA pixels.
+   */
+  static void encodeBlock(const uint8_t* pixels, int speed, uint8_t* block);
+
+};
@@ -0,0 +1,479 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file BlockCompressor.cc
+ */
+
+#include "BlockCompressor.hh"
+
+#include "LZEstimator.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <squish.h>
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * Optimal endpoints for a single colour channel, such that the 2/3 interpolant of the endpoints
+ * (the one selected by index 2) is as close as possible to the given 8-bit value.
+ */
+struct SolidTable
+{
+  uint8_t high[256];
+  uint8_t low[256];
+
+  explicit SolidTable(int bits)
+  {
+    int nValues = 1 << bits;
+
+    for (int value = 0; value < 256; ++value) {
+      int bestError = 256;
+
+      for (int i = 0; i < nValues; ++i) {
+        for (int j = 0; j < nValues; ++j) {
+          int a     = (i << (8 - bits)) | (i >> (2 * bits - 8));
+          int b     = (j << (8 - bits)) | (j >> (2 * bits - 8));
+          int error = abs((2 * a + b) / 3 - value);
+
+          if (error < bestError) {
+            bestError   = error;
+            high[value] = uint8_t(i);
+            low[value]  = uint8_t(j);
+          }
+        }
+      }
+    }
+  }
+};
+
+}
+
+static const SolidTable SOLID_5(5);
+static const SolidTable SOLID_6(6);
+
+// Decode endpoints and interpolants of a DXT colour block as RGBA. Blocks with colour0 <= colour1
+// are in three-colour mode only for DXT1, where the last entry is transparent black.
+static void colourPalette(const uint8_t* colourBlock, bool isDxt1, int palette[4][4])
+{
+  int  colours[2]  = { colourBlock[0] | colourBlock[1] << 8, colourBlock[2] | colourBlock[3] << 8 };
+  bool isFourColor = !isDxt1 || colours[0] > colours[1];
+
+  for (int i = 0; i < 2; ++i) {
+    int r = (colours[i] >> 11) & 0x1f;
+    int g = (colours[i] >> 5) & 0x3f;
+    int b = colours[i] & 0x1f;
+
+    palette[i][0] = r << 3 | r >> 2;
+    palette[i][1] = g << 2 | g >> 4;
+    palette[i][2] = b << 3 | b >> 2;
+    palette[i][3] = 255;
+  }
+
+  for (int k = 0; k < 3; ++k) {
+    if (isFourColor) {
+      palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+      palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+    }
+    else {
+      palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+      palette[3][k] = 0;
+    }
+  }
+  palette[2][3] = 255;
+  palette[3][3] = isFourColor ? 255 : 0;
+}
+
+// Squared RGB error of a colour block over masked (opaque) pixels, stops counting above `limit`.
+static int colourError(const uint8_t* pixels, uint32_t mask, const uint8_t* colourBlock,
+                       bool isDxt1, int limit)
+{
+  int palette[4][4];
+  colourPalette(colourBlock, isDxt1, palette);
+
+  int error = 0;
+
+  for (int i = 0; i < 16 && error <= limit; ++i) {
+    if (mask & (1u << i)) {
+      const int* entry = palette[(colourBlock[4 + i / 4] >> (2 * (i % 4))) & 3];
+      int        dr    = pixels[i * 4 + 0] - entry[0];
+      int        dg    = pixels[i * 4 + 1] - entry[1];
+      int        db    = pixels[i * 4 + 2] - entry[2];
+
+      // Transparent entry must never replace an opaque pixel.
+      error += entry[3] == 0 ? 3 * 255 * 255 : dr*dr + dg*dg + db*db;
+    }
+  }
+  return error;
+}
+
+// Choose the nearest opaque palette entry for each pixel, given block endpoints.
+static void selectColourIndices(const uint8_t* pixels, uint32_t mask, uint8_t* colourBlock,
+                                bool isDxt1)
+{
+  int palette[4][4];
+  colourPalette(colourBlock, isDxt1, palette);
+
+  memset(colourBlock + 4, 0, 4);
+
+  for (int i = 0; i < 16; ++i) {
+    if (mask & (1u << i)) {
+      int bestIndex = 0;
+      int bestError = 4 * 255 * 255;
+
+      for (int j = 0; j < 4; ++j) {
+        int dr    = pixels[i * 4 + 0] - palette[j][0];
+        int dg    = pixels[i * 4 + 1] - palette[j][1];
+        int db    = pixels[i * 4 + 2] - palette[j][2];
+        int error = dr*dr + dg*dg + db*db;
+
+        if (palette[j][3] != 0 && error < bestError) {
+          bestError = error;
+          bestIndex = j;
+        }
+      }
+      colourBlock[4 + i / 4] = uint8_t(colourBlock[4 + i / 4] | bestIndex << (2 * (i % 4)));
+    }
+  }
+}
+
+// Squared error of a DXT5 alpha block over masked pixels, stops counting above `limit`.
+static int alphaError(const uint8_t* pixels, uint32_t mask, const uint8_t* alphaBlock, int limit)
+{
+  int palette[8] = { alphaBlock[0], alphaBlock[1] };
+
+  if (alphaBlock[0] > alphaBlock[1]) {
+    for (int i = 1; i < 7; ++i) {
+      palette[i + 1] = ((7 - i) * alphaBlock[0] + i * alphaBlock[1]) / 7;
+    }
+  }
+  else {
+    for (int i = 1; i < 5; ++i) {
+      palette[i + 1] = ((5 - i) * alphaBlock[0] + i * alphaBlock[1]) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+
+  uint64_t indices = 0;
+  for (int i = 7; i >= 2; --i) {
+    indices = indices << 8 | alphaBlock[i];
+  }
+
+  int error = 0;
+
+  for (int i = 0; i < 16 && error <= limit; ++i) {
+    if (mask & (1u << i)) {
+      int da = pixels[i * 4 + 3] - palette[(indices >> (3 * i)) & 7];
+
+      error += da * da;
+    }
+  }
+  return error;
+}
+
+static int countPixels(uint32_t mask)
+{
+  int nPixels = 0;
+
+  for (; mask != 0; mask &= mask - 1) {
+    ++nPixels;
+  }
+  return nPixels;
+}
+
+size_t BlockCompressor::BlockHash::operator () (const Block& b) const
+{
+  // FNV-1a over 32-bit words.
+  uint64_t hash = 14695981039346656037ull ^ b.mask;
+
+  for (int i = 0; i < 64; i += 4) {
+    uint32_t word;
+    memcpy(&word, b.pixels + i, sizeof(word));
+
+    hash = (hash ^ word) * 1099511628211ull;
+  }
+  return size_t(hash ^ (hash >> 32));
+}
+
+void BlockCompressor::encodeSolid(const uint8_t* rgba, uint8_t* block) const
+{
+  uint8_t* colourBlock = block;
+
+  if (flags & squish::kDxt3) {
+    uint8_t alpha = uint8_t((rgba[3] + 8) / 17);
+
+    memset(block, alpha | (alpha << 4), 8);
+    colourBlock += 8;
+  }
+  else if (flags & squish::kDxt5) {
+    block[0] = rgba[3];
+    block[1] = rgba[3];
+    memset(block + 2, 0, 6);
+    colourBlock += 8;
+  }
+
+  int colour0 = SOLID_5.high[rgba[0]] << 11 | SOLID_6.high[rgba[1]] << 5 | SOLID_5.high[rgba[2]];
+  int colour1 = SOLID_5.low[rgba[0]] << 11 | SOLID_6.low[rgba[1]] << 5 | SOLID_5.low[rgba[2]];
+  int indices = 0xaa;
+
+  // Endpoints must be ordered colour0 > colour1 for four-colour mode. When swapped, index 3 selects
+  // the same interpolant. When equal, index 0 gives the exact colour in both modes.
+  if (colour0 < colour1) {
+    swap(colour0, colour1);
+    indices = 0xff;
+  }
+  else if (colour0 == colour1) {
+    indices = 0x00;
+  }
+
+  colourBlock[0] = uint8_t(colour0);
+  colourBlock[1] = uint8_t(colour0 >> 8);
+  colourBlock[2] = uint8_t(colour1);
+  colourBlock[3] = uint8_t(colour1 >> 8);
+  memset(colourBlock + 4, indices, 4);
+}
+
+bool BlockCompressor::optimiseColour(const Block& source, uint8_t* colourBlock) const
+{
+  bool isDxt1 = (flags & squish::kDxt1) != 0;
+  int  offset = blockSize - 8;
+  int  limit  = colourError(source.pixels, source.mask, colourBlock, isDxt1, INT32_MAX) +
+                int(rdoErrorSq * 3.0 * countPixels(source.mask));
+
+  uint8_t best[8];
+  int     bestGain  = 0;
+  int     bestError = limit + 1;
+
+  // Longer repeated runs are preferred, the whole 8-byte colour part over endpoints or selectors
+  // only (4 bytes). Among equal ones the smallest error wins and among equal errors the nearest
+  // block, as closer matches are cheaper for LZ.
+  auto consider = [&](const uint8_t* trial, int gain)
+  {
+    if (gain < bestGain) {
+      return;
+    }
+
+    int error = colourError(source.pixels, source.mask, trial, isDxt1, limit);
+
+    if (error <= limit && (gain > bestGain || error < bestError)) {
+      memcpy(best, trial, 8);
+      bestGain  = gain;
+      bestError = error;
+    }
+  };
+
+  int nEntries = int(history.size());
+
+  for (int i = 1; i <= nEntries; ++i) {
+    int            index     = (historyPos - i + nEntries) % nEntries;
+    const uint8_t* candidate = history[size_t(index)].data + offset;
+    uint8_t        trial[8];
+
+    consider(candidate, 8);
+
+    memcpy(trial, candidate, 4);
+    selectColourIndices(source.pixels, source.mask, trial, isDxt1);
+    consider(trial, 4);
+
+    memcpy(trial, colourBlock, 4);
+    memcpy(trial + 4, candidate + 4, 4);
+    consider(trial, 4);
+  }
+
+  if (bestGain == 0 || memcmp(best, colourBlock, 8) == 0) {
+    return false;
+  }
+
+  memcpy(colourBlock, best, 8);
+  return true;
+}
+
+bool BlockCompressor::optimiseAlpha(const Block& source, uint8_t* alphaBlock) const
+{
+  int limit = alphaError(source.pixels, source.mask, alphaBlock, INT32_MAX) +
+              int(rdoErrorSq * countPixels(source.mask));
+
+  uint8_t best[8];
+  int     bestGain  = 0;
+  int     bestError = limit + 1;
+
+  auto consider = [&](const uint8_t* trial, int gain)
+  {
+    if (gain < bestGain) {
+      return;
+    }
+
+    int error = alphaError(source.pixels, source.mask, trial, limit);
+
+    if (error <= limit && (gain > bestGain || error < bestError)) {
+      memcpy(best, trial, 8);
+      bestGain  = gain;
+      bestError = error;
+    }
+  };
+
+  int nEntries = int(history.size());
+
+  for (int i = 1; i <= nEntries; ++i) {
+    int            index     = (historyPos - i + nEntries) % nEntries;
+    const uint8_t* candidate = history[size_t(index)].data;
+    uint8_t        trial[8];
+
+    consider(candidate, 8);
+
+    memcpy(trial, alphaBlock, 2);
+    memcpy(trial + 2, candidate + 2, 6);
+    consider(trial, 6);
+  }
+
+  if (bestGain == 0 || memcmp(best, alphaBlock, 8) == 0) {
+    return false;
+  }
+
+  memcpy(alphaBlock, best, 8);
+  return true;
+}
+
+void BlockCompressor::encode(const Block& source, uint8_t* block)
+{
+  const uint8_t* first   = nullptr;
+  bool           isSolid = true;
+
+  for (int i = 0; i < 16; ++i) {
+    if (source.mask & (1u << i)) {
+      const uint8_t* pixel = source.pixels + i * 4;
+
+      if (first == nullptr) {
+        first = pixel;
+      }
+      else if (memcmp(pixel, first, 4) != 0) {
+        isSolid = false;
+        break;
+      }
+    }
+  }
+
+  ++stats.nBlocks;
+
+  // Transparent DXT1 pixels need the three-colour mode, leave them to squish.
+  bool hasTransparency = (flags & squish::kDxt1) && first != nullptr && first[3] < 128;
+
+  if (isSolid && first != nullptr && !hasTransparency) {
+    ++stats.nSolid;
+    encodeSolid(first, block);
+  }
+  else {
+    auto i = cache.find(source);
+
+    if (i != cache.end()) {
+      ++stats.nCached;
+      memcpy(block, i->second.data, size_t(blockSize));
+    }
+    else {
+      squish::CompressMasked(source.pixels, int(source.mask), block, flags);
+
+      if (int(cache.size()) < MAX_CACHE_SIZE) {
+        Encoded encoded;
+        memcpy(encoded.data, block, size_t(blockSize));
+
+        cache.insert(make_pair(source, encoded));
+      }
+    }
+  }
+
+  if (rdoErrorSq == 0.0) {
+    return;
+  }
+
+  originalData.insert(originalData.end(), block, block + blockSize);
+
+  // Solid blocks are already as repetitive as they get.
+  if (!isSolid) {
+    for (int i = 0; i < 16 && !hasTransparency && (flags & squish::kDxt1); ++i) {
+      hasTransparency = (source.mask & (1u << i)) && source.pixels[i * 4 + 3] < 128;
+    }
+
+    bool isChanged = !hasTransparency && optimiseColour(source, block + blockSize - 8);
+
+    if (flags & squish::kDxt5) {
+      isChanged |= optimiseAlpha(source, block);
+    }
+    stats.nRDO += isChanged;
+  }
+
+  outputData.insert(outputData.end(), block, block + blockSize);
+
+  Encoded encoded;
+  memcpy(encoded.data, block, size_t(blockSize));
+
+  if (int(history.size()) < RDO_WINDOW) {
+    history.push_back(encoded);
+  }
+  else {
+    history[size_t(historyPos)] = encoded;
+  }
+  historyPos = (historyPos + 1) % RDO_WINDOW;
+}
+
+BlockCompressor::BlockCompressor(int squishFlags, double rdoError) :
+  flags(squishFlags), blockSize(squishFlags & squish::kDxt1 ? 8 : 16),
+  rdoErrorSq(rdoError > 0.0 ? rdoError * rdoError : 0.0)
+{}
+
+void BlockCompressor::compress(const uint8_t* rgba, int width, int height, void* blocks)
+{
+  uint8_t* block = static_cast<uint8_t*>(blocks);
+
+  // Same block order and masking of pixels outside the image as `squish::CompressImage()`.
+  for (int y = 0; y < height; y += 4) {
+    for (int x = 0; x < width; x += 4) {
+      Block source;
+      memset(&source, 0, sizeof(source));
+
+      for (int py = 0; py < 4; ++py) {
+        for (int px = 0; px < 4; ++px) {
+          int sx = x + px;
+          int sy = y + py;
+
+          if (sx < width && sy < height) {
+            memcpy(source.pixels + (py * 4 + px) * 4, rgba + (sy * width + sx) * 4, 4);
+            source.mask |= 1u << (py * 4 + px);
+          }
+        }
+      }
+
+      encode(source, block);
+      block += blockSize;
+    }
+  }
+}
+
+void BlockCompressor::estimateRDOGain(size_t* originalSize, size_t* rdoSize) const
+{
+  *originalSize = LZEstimator::estimate(originalData.data(), originalData.size());
+  *rdoSize      = LZEstimator::estimate(outputData.data(), outputData.size());
+}
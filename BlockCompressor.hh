@@ -0,0 +1,139 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file BlockCompressor.hh
+ *
+ * `BlockCompressor` class.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * %BlockCompressor is a drop-in replacement for `squish::CompressImage()` that avoids running the
+ * expensive cluster fit where it is not needed.
+ *
+ * Solid-colour blocks are encoded directly using precomputed tables of optimal DXT endpoints. Other
+ * blocks are looked up in a cache of already encoded blocks, so repeated blocks (common in flat
+ * areas of part textures and UI atlases) are only compressed once. One instance should be used for
+ * all faces and mipmaps of an image.
+ *
+ * Optionally, blocks are rate-distortion optimised for BC1/BC3: within a given error budget, colour
+ * and alpha parts are replaced by bit patterns of recently emitted blocks (whole parts, endpoints or
+ * selectors), so that LZ-based archivers find many more matches. The GPU format does not change.
+ */
+class BlockCompressor
+{
+public:
+
+  /// Maximum number of cached blocks, about 6 MiB.
+  static const int MAX_CACHE_SIZE = 1 << 16;
+
+  /// Number of recently emitted blocks searched for reusable bit patterns when doing RDO.
+  static const int RDO_WINDOW = 64;
+
+  /**
+   * Compression statistics.
+   */
+  struct Stats
+  {
+    long nBlocks = 0; ///< All blocks.
+    long nSolid  = 0; ///< Solid-colour blocks.
+    long nCached = 0; ///< Blocks found in the cache.
+    long nRDO    = 0; ///< Blocks changed by RDO to repeat earlier bit patterns.
+  };
+
+private:
+
+  struct Block
+  {
+    uint8_t  pixels[64];
+    uint32_t mask;
+
+    bool operator == (const Block& b) const
+    {
+      return mask == b.mask && memcmp(pixels, b.pixels, sizeof(pixels)) == 0;
+    }
+  };
+
+  struct BlockHash
+  {
+    size_t operator () (const Block& b) const;
+  };
+
+  struct Encoded
+  {
+    uint8_t data[16];
+  };
+
+  int                                           flags;
+  int                                           blockSize;
+  double                                        rdoErrorSq;
+  std::unordered_map<Block, Encoded, BlockHash> cache;
+  Stats                                         stats;
+  std::vector<Encoded>                          history;
+  int                                           historyPos = 0;
+  std::vector<uint8_t>                          originalData;
+  std::vector<uint8_t>                          outputData;
+
+  void encodeSolid(const uint8_t* rgba, uint8_t* block) const;
+  bool optimiseColour(const Block& source, uint8_t* colourBlock) const;
+  bool optimiseAlpha(const Block& source, uint8_t* alphaBlock) const;
+  void encode(const Block& source, uint8_t* block);
+
+public:
+
+  /**
+   * Create compressor for given squish flags.
+   *
+   * RDO is enabled when `rdoError` is positive. A block may then be changed as long as its mean
+   * squared error per channel grows by at most `rdoError`^2, i.e. `rdoError` is the allowed RMS error
+   * increase in 8-bit levels.
+   */
+  explicit BlockCompressor(int squishFlags, double rdoError = 0.0);
+
+  /**
+   * Compress an RGBA image, same as `squish::CompressImage()`.
+   */
+  void compress(const uint8_t* rgba, int width, int height, void* blocks);
+
+  /**
+   * Statistics for all images compressed by this instance.
+   */
+  const Stats& getStats() const
+  {
+    return stats;
+  }
+
+  /**
+   * Estimated LZ-compressed size of all compressed data without and with RDO.
+   *
+   * Both are 0 if RDO is disabled.
+   */
+  void estimateRDOGain(size_t* originalSize, size_t* rdoSize) const;
+
+};
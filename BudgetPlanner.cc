@@ -0,0 +1,141 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file BudgetPlanner.cc
+ */
+
+#include "BudgetPlanner.hh"
+
+#include "ImageBuilder.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+static const char* const PRIORITY_NAMES[] = { "normal", "model", "ui" };
+
+// UI textures only go down to a half, blurry text and icons are more noticeable than blurry parts.
+static const double MIN_SCALES[] = { 0.25, 0.25, 0.5 };
+
+// All scales are powers of two, so power-of-two textures stay power-of-two with whole DXT blocks
+// and complete mipmap chains, and DDS sources can be shrunk by dropping mipmap levels.
+static double textureScale(const BudgetPlanner::Texture& texture, double classScale)
+{
+  int    minDim = min(texture.width, texture.height);
+  double scale  = classScale;
+
+  while (scale < 1.0 && double(minDim) * scale < double(BudgetPlanner::MIN_SIZE)) {
+    scale *= 2.0;
+  }
+  return min(1.0, scale);
+}
+
+size_t BudgetPlanner::totalSize(int priority, double scale)
+{
+  size_t size = 0;
+
+  for (const Texture& texture : textures) {
+    double classScale = texture.priority == priority ? scale : scales[texture.priority];
+    double finalScale = textureScale(texture, classScale);
+
+    size += ImageBuilder::estimateSize(texture.width, texture.height, texture.hasAlpha,
+                                       texture.options, finalScale);
+  }
+  return size;
+}
+
+void BudgetPlanner::add(const Texture& texture)
+{
+  textures.push_back(texture);
+}
+
+bool BudgetPlanner::plan(size_t budget)
+{
+  bool isMet = totalSize(0, scales[0]) <= budget;
+
+  for (int i = 0; i < N_PRIORITIES && !isMet; ++i) {
+    if (totalSize(i, MIN_SCALES[i]) > budget) {
+      scales[i] = MIN_SCALES[i];
+      continue;
+    }
+
+    // Find the largest power-of-two scale of this class that still fits. It cannot go below the
+    // minimum scale, which fits.
+    double scale = 0.5;
+
+    while (scale > MIN_SCALES[i] && totalSize(i, scale) > budget) {
+      scale /= 2.0;
+    }
+
+    scales[i] = scale;
+    isMet     = true;
+  }
+
+  for (Texture& texture : textures) {
+    texture.scale = textureScale(texture, scales[texture.priority]);
+    texture.size  = ImageBuilder::estimateSize(texture.width, texture.height, texture.hasAlpha,
+                                               texture.options, texture.scale);
+  }
+  return isMet;
+}
+
+void BudgetPlanner::printAllocation(size_t budget) const
+{
+  size_t total = 0;
+
+  printf("\nBudget  %.1f MiB\n", double(budget) / (1024.0 * 1024.0));
+
+  for (int i = 0; i < N_PRIORITIES; ++i) {
+    int    nTextures = 0;
+    size_t size      = 0;
+
+    for (const Texture& texture : textures) {
+      if (texture.priority == i) {
+        ++nTextures;
+        size += texture.size;
+      }
+    }
+
+    printf("  %-6s  scale %.3f  %6d textures  %9.1f MiB\n",
+           PRIORITY_NAMES[i], scales[i], nTextures, double(size) / (1024.0 * 1024.0));
+
+    total += size;
+  }
+
+  printf("Total   %.1f MiB%s\n",
+         double(total) / (1024.0 * 1024.0),
+         total > budget ? "  OVER BUDGET" : "");
+}
+
+bool BudgetPlanner::parsePriority(const char* name, Priority* priority)
+{
+  for (int i = 0; i < N_PRIORITIES; ++i) {
+    if (strcmp(name, PRIORITY_NAMES[i]) == 0) {
+      *priority = Priority(i);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,115 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file BudgetPlanner.hh
+ *
+ * `BudgetPlanner` class.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * %BudgetPlanner chooses per-texture scale factors so that converted textures fit into a given
+ * amount of GPU memory.
+ *
+ * Textures are divided into priority classes. The lowest priority class (normal maps) is shrunk
+ * first, down to its minimum scale, then models and UI textures last. Within a class the largest
+ * power-of-two scale that still fits the budget is found, sizes are computed by
+ * `ImageBuilder::estimateSize()`, so they match what `ImageBuilder::createDDS()` generates.
+ */
+class BudgetPlanner
+{
+public:
+
+  /**
+   * Priority classes, lower priority textures are scaled down first.
+   */
+  enum Priority
+  {
+    NORMAL_MAP,
+    MODEL,
+    UI,
+    N_PRIORITIES
+  };
+
+  /// Textures are not shrunk below this size (unless they are smaller already).
+  static const int MIN_SIZE = 32;
+
+  /**
+   * Texture to be converted.
+   */
+  struct Texture
+  {
+    std::string file;                ///< Source image.
+    int         options  = 0;        ///< `ImageBuilder` options.
+    Priority    priority = MODEL;    ///< Priority class.
+    int         width    = 0;        ///< Source width.
+    int         height   = 0;        ///< Source height.
+    bool        hasAlpha = false;    ///< Source has alpha channel.
+    double      scale    = 1.0;      ///< Chosen scale.
+    size_t      size     = 0;        ///< Output size with the chosen scale.
+  };
+
+private:
+
+  std::vector<Texture> textures;
+  double               scales[N_PRIORITIES] = { 1.0, 1.0, 1.0 };
+
+  size_t totalSize(int priority, double scale);
+
+public:
+
+  /**
+   * Add a texture.
+   */
+  void add(const Texture& texture);
+
+  /**
+   * Choose scales of all textures to fit a budget in bytes.
+   *
+   * @return false iff the budget cannot be met even with minimum scales.
+   */
+  bool plan(size_t budget);
+
+  /**
+   * Textures with their chosen scales.
+   */
+  const std::vector<Texture>& getTextures() const
+  {
+    return textures;
+  }
+
+  /**
+   * Print memory allocated to each priority class.
+   */
+  void printAllocation(size_t budget) const;
+
+  /**
+   * Parse priority class name ("normal", "model" or "ui").
+   */
+  static bool parsePriority(const char* name, Priority* priority);
+
+};
@@ -0,0 +1,200 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file ConversionRules.cc
+ */
+
+#include "ConversionRules.hh"
+
+#include "ImageBuilder.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+static bool parseClass(const string& name, ConversionRules::Class* type)
+{
+  if (name == "skip") {
+    *type = ConversionRules::SKIP;
+  }
+  else if (name == "ui") {
+    *type = ConversionRules::UI;
+  }
+  else if (name == "model") {
+    *type = ConversionRules::MODEL;
+  }
+  else if (name == "normal") {
+    *type = ConversionRules::NORMAL_MAP;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+ConversionRules::ConversionRules()
+{
+  options[SKIP]       = 0;
+  options[UI]         = parseOptions("vc");
+  options[MODEL]      = parseOptions("vcm");
+  options[NORMAL_MAP] = parseOptions("vcmns");
+
+  for (double& scale : scales) {
+    scale = 1.0;
+  }
+}
+
+bool ConversionRules::load(const char* file)
+{
+  ifstream is(file);
+
+  if (!is.is_open()) {
+    printf("Failed to open rules '%s'.\n", file);
+    return false;
+  }
+
+  string line;
+  int    lineNum = 0;
+
+  while (getline(is, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    stringstream ss(line);
+    string       keyword, argument;
+
+    ++lineNum;
+    ss >> keyword >> ws;
+
+    if (keyword.empty() || keyword[0] == '#') {
+      continue;
+    }
+
+    try {
+      if (keyword == "options") {
+        string letters;
+        Class  type;
+        double scale = 1.0;
+
+        ss >> argument >> letters;
+
+        if (ss.fail() || !parseClass(argument, &type) || type == SKIP) {
+          printf("%s:%d: Invalid options rule.\n", file, lineNum);
+          return false;
+        }
+
+        ss >> scale;
+
+        options[type] = parseOptions(letters);
+        scales[type]  = scale > 0.0 ? scale : 1.0;
+        continue;
+      }
+
+      getline(ss, argument);
+
+      Class type;
+
+      if (keyword == "normals") {
+        normalPatterns.push_back(regex(argument));
+      }
+      else if (parseClass(keyword, &type) && type != NORMAL_MAP && !argument.empty()) {
+        rules.push_back(Rule { type, regex(argument) });
+      }
+      else {
+        printf("%s:%d: Invalid rule '%s'.\n", file, lineNum, line.c_str());
+        return false;
+      }
+    }
+    catch (const regex_error&) {
+      printf("%s:%d: Invalid pattern '%s'.\n", file, lineNum, argument.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+ConversionRules::Class ConversionRules::classify(const string& path) const
+{
+  for (const Rule& rule : rules) {
+    if (regex_search(path, rule.pattern, regex_constants::match_continuous)) {
+      return rule.type;
+    }
+  }
+  return UI;
+}
+
+bool ConversionRules::isNormalName(const string& path) const
+{
+  for (const regex& pattern : normalPatterns) {
+    if (regex_search(path, pattern, regex_constants::match_continuous)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int ConversionRules::optionBit(char letter)
+{
+  switch (letter) {
+    case 'h': {
+      return ImageBuilder::FLOP_BIT;
+    }
+    case 'v': {
+      return ImageBuilder::FLIP_BIT;
+    }
+    case 'c': {
+      return ImageBuilder::COMPRESSION_BIT;
+    }
+    case 'b': {
+      return ImageBuilder::BC7_BIT;
+    }
+    case 'm': {
+      return ImageBuilder::MIPMAPS_BIT;
+    }
+    case 's': {
+      return ImageBuilder::YYYX_BIT;
+    }
+    case 'S': {
+      return ImageBuilder::ZYZX_BIT;
+    }
+    case 'n': {
+      return ImageBuilder::NORMAL_MAP_BIT;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+int ConversionRules::parseOptions(const string& letters)
+{
+  int bits = 0;
+
+  for (char c : letters) {
+    bits |= optionBit(c);
+  }
+  return bits;
+}
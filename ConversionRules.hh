@@ -0,0 +1,126 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file ConversionRules.hh
+ *
+ * `ConversionRules` class.
+ */
+
+#pragma once
+
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+ * Path-based rules that assign conversion options to textures.
+ *
+ * Rules are read from a text file, one per line, `#` starts a comment:
+ *
+ *     skip <regex>                      leave matching textures intact
+ *     ui <regex>                        matching textures are UI textures
+ *     model <regex>                     matching textures are model textures
+ *     normals <regex>                   models with matching names are normal maps
+ *     options <class> <letters> [<scale>]
+ *                                       options and scale for ui, model or normal class
+ *
+ * Patterns must match the beginning of a path relative to the watched directory. The first matching
+ * `skip`/`ui`/`model` rule decides the class, unmatched textures are UI textures. Models that don't
+ * match any `normals` pattern are checked for normal maps by pixels.
+ */
+class ConversionRules
+{
+public:
+
+  /// Texture class.
+  enum Class
+  {
+    SKIP,
+    UI,
+    MODEL,
+    NORMAL_MAP,
+    N_CLASSES
+  };
+
+private:
+
+  struct Rule
+  {
+    Class      type;
+    std::regex pattern;
+  };
+
+  std::vector<Rule>       rules;
+  std::vector<std::regex> normalPatterns;
+  int                     options[N_CLASSES];
+  double                  scales[N_CLASSES];
+
+public:
+
+  /**
+   * Create rules with no patterns and the same default options as `dds.py`.
+   */
+  ConversionRules();
+
+  /**
+   * Add rules from a file.
+   */
+  bool load(const char* file);
+
+  /**
+   * Class of a texture by its path.
+   */
+  Class classify(const std::string& path) const;
+
+  /**
+   * True iff the path matches one of normal map name patterns.
+   */
+  bool isNormalName(const std::string& path) const;
+
+  /**
+   * `ImageBuilder` options for a class.
+   */
+  int getOptions(Class type) const
+  {
+    return options[type];
+  }
+
+  /**
+   * Scale for a class.
+   */
+  double getScale(Class type) const
+  {
+    return scales[type];
+  }
+
+  /**
+   * `ImageBuilder` option bit for a command-line flag letter or 0 if the letter is not an option.
+   */
+  static int optionBit(char letter);
+
+  /**
+   * Sum of option bits for a string of flag letters, "-" for none.
+   */
+  static int parseOptions(const std::string& letters);
+
+};
@@ -0,0 +1,520 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Coordinator.cc
+ *
+ * Protocol: the worker writes `ready\n` once started. The coordinator then writes
+ * `<options>\t<scale>\t<file>\t<destFile>\n` for each job, with absolute paths, and the worker
+ * replies `0\n` on success or `1\n` on failure once the job is done.
+ */
+
+#include "Coordinator.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+using namespace std;
+
+Coordinator::Coordinator(const vector<string>& commands_, const string& workerArgs_,
+                         int nWorkers_, double timeout_, size_t memoryBudget) :
+  commands(commands_), workerArgs(workerArgs_), nWorkers(max(nWorkers_, 1)),
+  timeout(max(timeout_, 0.0)), budget(memoryBudget == 0 ? size_t(-1) : memoryBudget)
+{}
+
+#ifndef _WIN32
+
+static bool writeAll(int fd, const string& data)
+{
+  for (size_t i = 0; i < data.size();) {
+    ssize_t n = write(fd, data.data() + i, data.size() - i);
+
+    if (n < 0 && errno != EINTR) {
+      return false;
+    }
+    i += n < 0 ? 0 : size_t(n);
+  }
+  return true;
+}
+
+static string absolutePath(const string& cwd, const string& path)
+{
+  return path.empty() || path[0] == '/' ? path : cwd + "/" + path;
+}
+
+bool Coordinator::spawn(Worker* worker)
+{
+  int toWorker[2];
+  int fromWorker[2];
+
+  if (pipe(toWorker) != 0) {
+    printf("Failed to create pipe: %s\n", strerror(errno));
+    return false;
+  }
+  if (pipe(fromWorker) != 0) {
+    printf("Failed to create pipe: %s\n", strerror(errno));
+    close(toWorker[0]);
+    close(toWorker[1]);
+    return false;
+  }
+
+  // Pipes must not leak into other workers, they would keep them open after this worker exits.
+  fcntl(toWorker[0], F_SETFD, FD_CLOEXEC);
+  fcntl(toWorker[1], F_SETFD, FD_CLOEXEC);
+  fcntl(fromWorker[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fromWorker[1], F_SETFD, FD_CLOEXEC);
+
+  string command = "exec " + commands[size_t(worker->command)] + " " + workerArgs;
+  pid_t  pid     = fork();
+
+  if (pid == 0) {
+    dup2(toWorker[0], STDIN_FILENO);
+    dup2(fromWorker[1], STDOUT_FILENO);
+
+    execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+
+  close(toWorker[0]);
+  close(fromWorker[1]);
+
+  if (pid < 0) {
+    printf("Failed to start worker: %s\n", strerror(errno));
+    close(toWorker[1]);
+    close(fromWorker[0]);
+    return false;
+  }
+
+  worker->pid    = int(pid);
+  worker->input  = toWorker[1];
+  worker->output = fromWorker[0];
+  worker->job     = -1;
+  worker->isReady = false;
+  worker->buffer.clear();
+  return true;
+}
+
+int Coordinator::stop(Worker* worker, bool doKill)
+{
+  int status = 0;
+
+  if (doKill) {
+    kill(pid_t(worker->pid), SIGKILL);
+  }
+
+  close(worker->input);
+  close(worker->output);
+
+  while (waitpid(pid_t(worker->pid), &status, 0) < 0 && errno == EINTR) {}
+
+  worker->pid    = -1;
+  worker->input  = -1;
+  worker->output = -1;
+  worker->job    = -1;
+  worker->buffer.clear();
+  return status;
+}
+
+void Coordinator::requeue(int job)
+{
+  // Pending jobs are kept sorted by descending memory.
+  auto i = upper_bound(pending.begin(), pending.end(), job, [this](int a, int b)
+  {
+    return jobs[size_t(a)].memory > jobs[size_t(b)].memory;
+  });
+  pending.insert(i, job);
+}
+
+void Coordinator::dispatch(Worker* worker, bool isAnyRunning)
+{
+  int  index          = int(worker - workers.data());
+  bool hasOtherWorker = any_of(workers.begin(), workers.end(), [worker](const Worker& w)
+  {
+    return w.pid >= 0 && &w != worker;
+  });
+
+  // A retried job goes to a different worker if there is one, its own one may be broken.
+  auto i = find_if(pending.begin(), pending.end(), [this, index, hasOtherWorker](int job)
+  {
+    return jobs[size_t(job)].memory <= budget - used &&
+           (lastWorkers[size_t(job)] != index || !hasOtherWorker);
+  });
+
+  // A job larger than the whole budget runs alone.
+  if (i == pending.end()) {
+    if (isAnyRunning || pending.empty()) {
+      return;
+    }
+    i = pending.begin();
+  }
+
+  const JobScheduler::Job& job = jobs[size_t(*i)];
+
+  worker->job   = *i;
+  worker->start = Clock::now();
+  used         += min(job.memory, budget - used);
+  pending.erase(i);
+
+  char header[64];
+  snprintf(header, sizeof(header), "%d\t%.17g\t", job.options, job.scale);
+
+  string line = header + absolutePath(cwd, job.file) + "\t" + absolutePath(cwd, job.destFile);
+
+  line += "\n";
+
+  if (!writeAll(worker->input, line)) {
+    handleCrash(worker, false);
+  }
+}
+
+void Coordinator::finish(Worker* worker, bool isSuccessful)
+{
+  const JobScheduler::Job& job  = jobs[size_t(worker->job)];
+  double                   time = chrono::duration<double>(Clock::now() - worker->start).count();
+
+  if (time > maxTime) {
+    maxTime = time;
+    slowest = worker->job;
+  }
+
+  used                  -= min(job.memory, used);
+  nFinished             += 1;
+  nFailed               += isSuccessful ? 0 : 1;
+  worker->job            = -1;
+  worker->nFailedStarts  = 0;
+
+  if (isSuccessful && onSuccess) {
+    onSuccess(job);
+  }
+}
+
+void Coordinator::handleCrash(Worker* worker, bool isTimeout)
+{
+  int  job     = worker->job;
+  bool isReady = worker->isReady;
+  int  status  = stop(worker, isTimeout);
+
+  if (job >= 0) {
+    used                     -= min(jobs[size_t(job)].memory, used);
+    lastWorkers[size_t(job)]  = int(worker - workers.data());
+  }
+
+  // The job, if any, is not to blame when the worker never got ready.
+  if (job < 0 || !isReady) {
+    const char* command = commands[size_t(worker->command)].c_str();
+
+    if (job >= 0) {
+      requeue(job);
+    }
+
+    // A command that cannot be run would fail again right away.
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+      printf("Failed to run worker command '%s'.\n", command);
+      return;
+    }
+
+    nCrashes              += 1;
+    worker->nFailedStarts += 1;
+
+    if (worker->nFailedStarts >= MAX_FAILED_STARTS) {
+      printf("Worker command '%s' keeps exiting, not restarting it.\n", command);
+      return;
+    }
+
+    printf(isReady ? "Worker exited while idle, restarting it.\n" :
+                     "Worker exited before it was ready, restarting it.\n");
+    spawn(worker);
+    return;
+  }
+
+  const char* file = jobs[size_t(job)].file.c_str();
+
+  used -= min(jobs[size_t(job)].memory, used);
+
+  if (isTimeout) {
+    printf("Timed out after %.0f s converting '%s'.\n", timeout, file);
+
+    nFinished += 1;
+    nFailed   += 1;
+    nTimeouts += 1;
+  }
+  else {
+    if (WIFSIGNALED(status)) {
+      printf("Worker killed by signal %d while converting '%s'.\n", WTERMSIG(status), file);
+    }
+    else {
+      printf("Worker exited with status %d while converting '%s'.\n", WEXITSTATUS(status), file);
+    }
+
+    nCrashes += 1;
+
+    if (attempts[size_t(job)]++ < MAX_RETRIES) {
+      nRetries += 1;
+      requeue(job);
+    }
+    else {
+      printf("Giving up on '%s' after %d attempts.\n", file, MAX_RETRIES + 1);
+
+      nFinished += 1;
+      nFailed   += 1;
+    }
+  }
+
+  spawn(worker);
+}
+
+void Coordinator::readStatus(Worker* worker)
+{
+  char    buffer[256];
+  ssize_t length = read(worker->output, buffer, sizeof(buffer));
+
+  if (length < 0 && errno == EINTR) {
+    return;
+  }
+  if (length <= 0) {
+    handleCrash(worker, false);
+    return;
+  }
+
+  worker->buffer.append(buffer, size_t(length));
+
+  for (size_t end = worker->buffer.find('\n'); end != string::npos;
+       end = worker->buffer.find('\n'))
+  {
+    bool isReady      = worker->buffer.compare(0, end, "ready") == 0;
+    bool isSuccessful = worker->buffer.compare(0, end, "0") == 0;
+
+    worker->buffer.erase(0, end + 1);
+
+    if (isReady) {
+      worker->isReady = true;
+    }
+    else if (worker->job >= 0) {
+      finish(worker, isSuccessful);
+    }
+  }
+}
+
+int Coordinator::run(const vector<JobScheduler::Job>& jobs_,
+                     const function<void(const JobScheduler::Job&)>& onSuccess_)
+{
+  char cwdBuffer[PATH_MAX];
+
+  if (getcwd(cwdBuffer, sizeof(cwdBuffer)) == nullptr) {
+    printf("Failed to get working directory: %s\n", strerror(errno));
+    return int(jobs_.size());
+  }
+
+  cwd       = cwdBuffer;
+  jobs      = jobs_;
+  onSuccess = onSuccess_;
+  used      = 0;
+  nFinished = 0;
+  nFailed   = 0;
+  nTimeouts = 0;
+  nCrashes  = 0;
+  nRetries  = 0;
+  maxTime   = 0.0;
+  slowest   = -1;
+  attempts.assign(jobs.size(), 0);
+  lastWorkers.assign(jobs.size(), -1);
+  pending.clear();
+
+  for (int i = 0; i < int(jobs.size()); ++i) {
+    requeue(i);
+  }
+
+  // Writes to crashed workers must fail instead of killing the coordinator.
+  signal(SIGPIPE, SIG_IGN);
+
+  Clock::time_point begin = Clock::now();
+
+  workers.assign(size_t(min(nWorkers, max(int(jobs.size()), 1))), Worker());
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].command = int(i % commands.size());
+    spawn(&workers[i]);
+  }
+
+  while (nFinished < int(jobs.size())) {
+    for (Worker& worker : workers) {
+      if (worker.pid >= 0 && worker.job < 0 && !pending.empty()) {
+        bool isAnyRunning = any_of(workers.begin(), workers.end(), [](const Worker& w)
+        {
+          return w.job >= 0;
+        });
+
+        dispatch(&worker, isAnyRunning);
+      }
+    }
+
+    vector<pollfd>  fds;
+    vector<Worker*> polled;
+    int             waitTime = -1;
+
+    for (Worker& worker : workers) {
+      if (worker.pid < 0) {
+        continue;
+      }
+
+      fds.push_back({ worker.output, POLLIN, 0 });
+      polled.push_back(&worker);
+
+      if (worker.job >= 0 && timeout != 0.0) {
+        double elapsed   = chrono::duration<double>(Clock::now() - worker.start).count();
+        int    remaining = max(int((timeout - elapsed) * 1000.0) + 1, 0);
+
+        waitTime = waitTime < 0 ? remaining : min(waitTime, remaining);
+      }
+    }
+
+    if (fds.empty()) {
+      printf("No workers left, %d images not converted.\n", int(jobs.size()) - nFinished);
+
+      nFailed  += int(jobs.size()) - nFinished;
+      nFinished = int(jobs.size());
+      break;
+    }
+
+    if (poll(fds.data(), fds.size(), waitTime) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("poll failed: %s\n", strerror(errno));
+
+      nFailed  += int(jobs.size()) - nFinished;
+      nFinished = int(jobs.size());
+      break;
+    }
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+      if (fds[i].revents != 0 && polled[i]->output == fds[i].fd) {
+        readStatus(polled[i]);
+      }
+    }
+
+    for (Worker& worker : workers) {
+      if (worker.job >= 0 && timeout != 0.0 &&
+          chrono::duration<double>(Clock::now() - worker.start).count() > timeout)
+      {
+        handleCrash(&worker, true);
+      }
+    }
+  }
+
+  // Workers exit once their stdin is closed.
+  for (Worker& worker : workers) {
+    if (worker.pid >= 0) {
+      stop(&worker, false);
+    }
+  }
+
+  double time = chrono::duration<double>(Clock::now() - begin).count();
+
+  printf("%d images on %d worker processes in %.1f s: %d failed (%d timed out), %d worker "
+         "crashes, %d retries\n", int(jobs.size()), int(workers.size()), time, nFailed, nTimeouts,
+         nCrashes, nRetries);
+
+  if (slowest >= 0) {
+    printf("Slowest: %.1f s '%s'\n", maxTime, jobs[size_t(slowest)].file.c_str());
+  }
+  return nFailed;
+}
+
+int Coordinator::serve(const function<bool(const JobScheduler::Job&)>& process)
+{
+  // Everything printed while converting goes to stderr, statuses to the original stdout.
+  fflush(stdout);
+
+  int   statusFd = dup(STDOUT_FILENO);
+  FILE* status   = statusFd < 0 ? nullptr : fdopen(statusFd, "w");
+
+  if (status == nullptr) {
+    printf("Failed to set up worker status output.\n");
+    return 1;
+  }
+
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  fprintf(status, "ready\n");
+  fflush(status);
+
+  string line;
+  int    nFailed = 0;
+
+  while (getline(cin, line)) {
+    JobScheduler::Job job;
+    stringstream      ss(line);
+    string            options, scale;
+    bool              isValid = getline(ss, options, '\t') && getline(ss, scale, '\t') &&
+                                getline(ss, job.file, '\t') && getline(ss, job.destFile);
+
+    if (isValid) {
+      stringstream(options) >> job.options;
+      stringstream(scale) >> job.scale;
+    }
+    else {
+      printf("Invalid job '%s'.\n", line.c_str());
+    }
+
+    bool isSuccessful = isValid && process(job);
+
+    nFailed += isSuccessful ? 0 : 1;
+
+    fflush(stdout);
+    fprintf(status, "%d\n", isSuccessful ? 0 : 1);
+    fflush(status);
+  }
+
+  fclose(status);
+  return nFailed;
+}
+
+#else
+
+int Coordinator::run(const vector<JobScheduler::Job>& jobs_,
+                     const function<void(const JobScheduler::Job&)>&)
+{
+  printf("Worker processes are not supported on Windows.\n");
+  return int(jobs_.size());
+}
+
+int Coordinator::serve(const function<bool(const JobScheduler::Job&)>&)
+{
+  printf("Worker processes are not supported on Windows.\n");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Coordinator.hh
+ *
+ * `Coordinator` class.
+ */
+
+#pragma once
+
+#include "JobScheduler.hh"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Distributes conversion jobs to worker processes.
+ *
+ * Each worker is started through `/bin/sh -c "<command> <workerArgs>"`, so commands like
+ * `ssh host img2dds` can run workers on other machines that share the filesystem. Jobs are sent
+ * over the worker's stdin one per line, with paths made absolute as workers may run in a different
+ * directory, and the worker answers each with a status line on stdout (see `serve()`). A worker
+ * that crashes only loses the job it was running, which is retried up to `MAX_RETRIES` times,
+ * preferably on another worker. A job that exceeds the timeout has its worker killed and is not
+ * retried.
+ *
+ * Workers announce themselves with a ready line once started. A worker that exits before that, or
+ * while idle, is restarted without charging its job, but after `MAX_FAILED_STARTS` such exits in a
+ * row its command is assumed to be broken (e.g. an unreachable ssh host) and it is given up.
+ *
+ * Like `JobScheduler`, the coordinator dispatches the largest pending job that fits into the memory
+ * budget, so a few huge images don't run concurrently on machines with little RAM per core.
+ *
+ * Not available on Windows.
+ */
+class Coordinator
+{
+public:
+
+  /// Number of times a job is retried after its worker crashed.
+  static const int MAX_RETRIES = 2;
+
+  /// Number of exits in a row not caused by a job after which a worker is not restarted.
+  static const int MAX_FAILED_STARTS = 2;
+
+private:
+
+  typedef std::chrono::steady_clock Clock;
+
+  /**
+   * Worker process.
+   */
+  struct Worker
+  {
+    int               pid           = -1;
+    int               input         = -1;    ///< Write end of worker's stdin.
+    int               output        = -1;    ///< Read end of worker's stdout.
+    int               command       = 0;     ///< Index of the command it was started with.
+    int               job           = -1;    ///< Running job or -1 if idle.
+    bool              isReady       = false; ///< Worker has sent its ready line.
+    int               nFailedStarts = 0;     ///< Exits not caused by a job since one finished.
+    Clock::time_point start;                 ///< When the running job was sent.
+    std::string       buffer;                ///< Incomplete status line.
+  };
+
+  std::vector<std::string>       commands;
+  std::string                    workerArgs;
+  int                            nWorkers;
+  double                         timeout;
+  size_t                         budget;
+  std::string                    cwd;
+
+  std::function<void(const JobScheduler::Job&)> onSuccess;
+
+  std::vector<JobScheduler::Job> jobs;
+  std::vector<int>               attempts;
+  std::vector<int>               lastWorkers; ///< Worker each job last crashed on or -1.
+  std::vector<int>               pending;
+  std::vector<Worker>            workers;
+  size_t                         used      = 0;
+  int                            nFinished = 0;
+  int                            nFailed   = 0;
+  int                            nTimeouts = 0;
+  int                            nCrashes  = 0;
+  int                            nRetries  = 0;
+  double                         maxTime   = 0.0;
+  int                            slowest   = -1;
+
+  bool spawn(Worker* worker);
+  int  stop(Worker* worker, bool doKill);
+  void requeue(int job);
+  void dispatch(Worker* worker, bool isAnyRunning);
+  void finish(Worker* worker, bool isSuccessful);
+  void handleCrash(Worker* worker, bool isTimeout);
+  void readStatus(Worker* worker);
+
+public:
+
+  /**
+   * Create a coordinator.
+   *
+   * @param commands commands that start `img2dds`, workers are assigned to them round-robin.
+   * @param workerArgs arguments appended to each command, must include `-w`.
+   * @param nWorkers number of worker processes.
+   * @param timeout maximum time for one job in seconds, 0 for unlimited.
+   * @param memoryBudget memory budget in bytes for all running jobs, 0 for unlimited.
+   */
+  Coordinator(const std::vector<std::string>& commands, const std::string& workerArgs,
+              int nWorkers, double timeout, size_t memoryBudget);
+
+  /**
+   * Run all jobs and print statistics.
+   *
+   * A coordinator can run several batches one after another.
+   *
+   * @param jobs jobs to run.
+   * @param onSuccess called for each successfully finished job, if given.
+   * @return number of failed jobs.
+   */
+  int run(const std::vector<JobScheduler::Job>& jobs,
+          const std::function<void(const JobScheduler::Job&)>& onSuccess = nullptr);
+
+  /**
+   * Worker side: read jobs from stdin until it is closed and process them.
+   *
+   * A `ready` line and then one status line per job (0 for success, 1 for failure) are written to
+   * the original stdout, while stdout itself is redirected to stderr, so messages printed during
+   * conversion reach the terminal without interfering with the protocol.
+   *
+   * @return number of failed jobs.
+   */
+  static int serve(const std::function<bool(const JobScheduler::Job&)>& process);
+
+};
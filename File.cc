@@ -0,0 +1,114 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file File.cc
+ */
+
+#include "File.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static bool isSymlink(const string& path)
+{
+#ifdef _WIN32
+  static_cast<void>(path);
+  return false;
+#else
+  struct stat info;
+  return lstat(path.c_str(), &info) == 0 && S_ISLNK(info.st_mode);
+#endif
+}
+
+static void listDirectory(const string& root, const string& prefix, vector<string>* files)
+{
+  string path = prefix.empty() ? root : root + "/" + prefix;
+  DIR*   dir  = opendir(path.c_str());
+
+  if (dir == nullptr) {
+    return;
+  }
+
+  for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    string name     = prefix.empty() ? string(entry->d_name) : prefix + "/" + entry->d_name;
+    string fullPath = root + "/" + name;
+
+    if (File::isDirectory(fullPath.c_str())) {
+      // Symlinked directories may form loops or list the same files twice.
+      if (!isSymlink(fullPath)) {
+        listDirectory(root, name, files);
+      }
+    }
+    else {
+      files->push_back(name);
+    }
+  }
+
+  closedir(dir);
+}
+
+bool File::isDirectory(const char* path)
+{
+  struct stat info;
+  return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+bool File::isImage(const char* path)
+{
+  static const char* const EXTENSIONS[] = { "png", "jpg", "jpeg", "tga", "bmp", "mbm", "dds" };
+
+  const char* dot = strrchr(path, '.');
+  if (dot == nullptr) {
+    return false;
+  }
+
+  string extension = dot + 1;
+  transform(extension.begin(), extension.end(), extension.begin(), [](char c)
+  {
+    return char(tolower(static_cast<unsigned char>(c)));
+  });
+
+  for (const char* e : EXTENSIONS) {
+    if (extension == e) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void File::listRecursively(const char* dir, vector<string>* files)
+{
+  size_t begin = files->size();
+
+  listDirectory(dir, "", files);
+  sort(files->begin() + ptrdiff_t(begin), files->end());
+}
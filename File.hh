@@ -0,0 +1,64 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file File.hh
+ *
+ * `File` class.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * Filesystem utilities.
+ */
+class File
+{
+public:
+
+  /**
+   * Forbid instances.
+   */
+  File() = delete;
+
+  /**
+   * True iff the path exists and is a directory.
+   */
+  static bool isDirectory(const char* path);
+
+  /**
+   * True iff the file has an extension of an image format `ImageBuilder` can load.
+   */
+  static bool isImage(const char* path);
+
+  /**
+   * Recursively list all regular files inside a directory, sorted by path.
+   *
+   * Paths are given relative to the directory and always use `/` as a separator. Symbolic links
+   * to directories are not followed.
+   */
+  static void listRecursively(const char* dir, std::vector<std::string>* files);
+
+};
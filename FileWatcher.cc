@@ -0,0 +1,198 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file FileWatcher.cc
+ */
+
+#include "FileWatcher.hh"
+
+#include "File.hh"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+# include <dirent.h>
+# include <poll.h>
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+
+using namespace std;
+
+const chrono::milliseconds FileWatcher::DEBOUNCE(100);
+
+#ifdef __linux__
+
+static const unsigned DIR_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+void FileWatcher::addTree(const string& dir, bool reportFiles)
+{
+  string path = dir.empty() ? root : root + "/" + dir;
+  int    wd   = inotify_add_watch(fd, path.c_str(), DIR_EVENTS);
+
+  if (wd < 0) {
+    printf("Failed to watch '%s'.\n", path.c_str());
+    return;
+  }
+  dirs[wd] = dir;
+
+  // Listing happens after the watch is added, so files created in between are reported twice at
+  // worst, never missed.
+  DIR* d = opendir(path.c_str());
+
+  if (d == nullptr) {
+    return;
+  }
+
+  for (dirent* entry = readdir(d); entry != nullptr; entry = readdir(d)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    string name     = dir.empty() ? string(entry->d_name) : dir + "/" + entry->d_name;
+    string fullPath = root + "/" + name;
+
+    if (File::isDirectory(fullPath.c_str())) {
+      addTree(name, reportFiles);
+    }
+    else if (reportFiles) {
+      changed[name] = Clock::now();
+    }
+  }
+
+  closedir(d);
+}
+
+void FileWatcher::readEvents()
+{
+  alignas(inotify_event) char buffer[64 * 1024];
+  ssize_t                     length = read(fd, buffer, sizeof(buffer));
+
+  for (ssize_t i = 0; i < length;) {
+    const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + i);
+    auto                 dir   = dirs.find(event->wd);
+
+    i += ssize_t(sizeof(inotify_event) + event->len);
+
+    if (event->mask & IN_IGNORED) {
+      dirs.erase(event->wd);
+      continue;
+    }
+    if (dir == dirs.end() || event->len == 0) {
+      continue;
+    }
+
+    string path = dir->second.empty() ? event->name : dir->second + "/" + event->name;
+
+    if (event->mask & IN_ISDIR) {
+      if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        addTree(path, true);
+      }
+    }
+    else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+      changed[path] = Clock::now();
+    }
+  }
+}
+
+FileWatcher::~FileWatcher()
+{
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool FileWatcher::init(const char* dir)
+{
+  fd = inotify_init1(IN_CLOEXEC);
+
+  if (fd < 0) {
+    printf("Failed to initialise inotify.\n");
+    return false;
+  }
+  if (!File::isDirectory(dir)) {
+    printf("Not a directory '%s'.\n", dir);
+    return false;
+  }
+
+  root = dir;
+  addTree("", false);
+
+  return !dirs.empty();
+}
+
+bool FileWatcher::wait(vector<string>* files)
+{
+  while (true) {
+    Clock::time_point now     = Clock::now();
+    int               timeout = -1;
+
+    for (auto i = changed.begin(); i != changed.end();) {
+      Clock::duration age = now - i->second;
+
+      if (age >= DEBOUNCE) {
+        files->push_back(i->first);
+        i = changed.erase(i);
+      }
+      else {
+        auto remaining = chrono::duration_cast<chrono::milliseconds>(DEBOUNCE - age).count() + 1;
+
+        timeout = timeout < 0 ? int(remaining) : min(timeout, int(remaining));
+        ++i;
+      }
+    }
+
+    if (!files->empty()) {
+      return true;
+    }
+
+    pollfd pfd = { fd, POLLIN, 0 };
+    int    ret = poll(&pfd, 1, timeout);
+
+    if (ret < 0) {
+      return false;
+    }
+    if (ret > 0) {
+      readEvents();
+    }
+  }
+}
+
+#else
+
+FileWatcher::~FileWatcher()
+{}
+
+bool FileWatcher::init(const char*)
+{
+  printf("Watching directories is only supported on Linux.\n");
+  return false;
+}
+
+bool FileWatcher::wait(vector<string>*)
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file FileWatcher.hh
+ *
+ * `FileWatcher` class.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Recursive directory watcher (Linux inotify).
+ *
+ * Reports files that have been written or moved into the watched tree. Editors and exporters often
+ * write a file in several steps, so a file is only reported once it has been quiet for `DEBOUNCE`.
+ * Newly created subdirectories are watched as well and files already inside them are reported.
+ */
+class FileWatcher
+{
+public:
+
+  /// Time a file must stay unmodified before it is reported.
+  static const std::chrono::milliseconds DEBOUNCE;
+
+private:
+
+  typedef std::chrono::steady_clock Clock;
+
+  int                                      fd = -1;
+  std::string                              root;
+  std::map<int, std::string>               dirs;    ///< Watch descriptor -> directory under root.
+  std::map<std::string, Clock::time_point> changed; ///< Changed file -> time of the last change.
+
+  void addTree(const std::string& dir, bool reportFiles);
+  void readEvents();
+
+public:
+
+  FileWatcher() = default;
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator = (const FileWatcher&) = delete;
+
+  /**
+   * Start watching a directory tree.
+   */
+  bool init(const char* dir);
+
+  /**
+   * Block until some changed files settle and append their paths, relative to the watched
+   * directory, to `files`.
+   *
+   * @return false on error or when interrupted by a signal.
+   */
+  bool wait(std::vector<std::string>* files);
+
+};
@@ -26,12 +26,22 @@
 
 #include "ImageBuilder.hh"
 
+#include "BC7Encoder.hh"
+#include "BlockCompressor.hh"
+#include "ImageDecoder.hh"
+#include "Kernels.hh"
+
 #include <algorithm>
-#include <assert.h>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <FreeImage.h>
 #include <squish.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 using namespace std;
@@ -59,19 +69,95 @@ static const unsigned DDSCAPS2_CUBEMAP_NEGITIVEZ         = 0x00008000;
 static const unsigned DDPF_ALPHAPIXELS                   = 0x00000001;
 static const unsigned DDPF_FOURCC                        = 0x00000004;
 static const unsigned DDPF_RGB                           = 0x00000040;
+static const unsigned DDPF_LUMINANCE                     = 0x00020000;
 static const unsigned DDPF_NORMAL                        = 0x80000000;
 
 static const unsigned DXGI_FORMAT_R8G8B8A8_UNORM         = 28;
+static const unsigned DXGI_FORMAT_R8G8B8A8_UNORM_SRGB    = 29;
 static const unsigned DXGI_FORMAT_BC1_UNORM              = 71;
+static const unsigned DXGI_FORMAT_BC1_UNORM_SRGB         = 72;
+static const unsigned DXGI_FORMAT_BC2_UNORM              = 74;
+static const unsigned DXGI_FORMAT_BC2_UNORM_SRGB         = 75;
 static const unsigned DXGI_FORMAT_BC3_UNORM              = 77;
+static const unsigned DXGI_FORMAT_BC3_UNORM_SRGB         = 78;
+static const unsigned DXGI_FORMAT_BC4_TYPELESS           = 79;
+static const unsigned DXGI_FORMAT_BC4_SNORM              = 81;
+static const unsigned DXGI_FORMAT_BC5_TYPELESS           = 82;
+static const unsigned DXGI_FORMAT_BC5_SNORM              = 84;
+static const unsigned DXGI_FORMAT_B8G8R8A8_UNORM         = 87;
+static const unsigned DXGI_FORMAT_B8G8R8X8_UNORM         = 88;
+static const unsigned DXGI_FORMAT_BC6H_TYPELESS          = 94;
+static const unsigned DXGI_FORMAT_BC7_TYPELESS           = 97;
+static const unsigned DXGI_FORMAT_BC7_UNORM              = 98;
+static const unsigned DXGI_FORMAT_BC7_UNORM_SRGB         = 99;
 
 static const unsigned D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+static const unsigned D3D10_RESOURCE_MISC_TEXTURECUBE    = 0x00000004;
+
+static const int      DDS_HEADER_SIZE                    = 128;
+static const int      DDS_DX10_HEADER_SIZE               = 148;
+
+/**
+ * Pixel format of a DDS file as far as `ImageBuilder` can read it.
+ */
+enum DDSFormat
+{
+  DDS_UNKNOWN,
+  DDS_UNCOMPRESSED,
+  DDS_DXT1,
+  DDS_DXT3,
+  DDS_DXT5,
+  DDS_BC7
+};
+
+/**
+ * Parsed DDS header, including DX10 extension.
+ */
+struct DDSHeader
+{
+  int       flags;
+  int       width;
+  int       height;
+  int       nMipmaps;
+  int       nFaces;
+  int       pixelFlags;
+  char      fourCC[5];
+  int       bpp;
+  unsigned  masks[4];
+  int       caps2;
+  int       dxgiFormat;
+  DDSFormat format;
+  int       blockSize;
+  int       dataOffset;
+};
+
+static double rdoError    = 0.0;
+static int    bc7Speed    = BC7Encoder::NORMAL;
+static int    bc7Threads  = 1;
 
 static inline int index1(int v)
 {
   return int(sizeof(int)) * 8 - 1 - __builtin_clz(unsigned(v));
 }
 
+static inline int scaledSize(int size, double scale)
+{
+  return max(int(lround(size * scale)), 1);
+}
+
+static inline int mipmapCount(int width, int height, bool doMipmaps)
+{
+  return doMipmaps ? index1(max(width, height)) + 1 : 1;
+}
+
+static inline int squishFlagsFor(bool hasAlpha, bool isPreview = false)
+{
+  int squishFlags = isPreview ? squish::kColourRangeFit : squish::kColourIterativeClusterFit;
+  squishFlags    |= squish::kWeightColourByAlpha;
+  squishFlags    |= hasAlpha ? squish::kDxt5 : squish::kDxt1;
+  return squishFlags;
+}
+
 static inline int readInt(FILE* f)
 {
   int i;
@@ -83,13 +169,14 @@ static inline int readInt(FILE* f)
   return i;
 }
 
-static inline void writeInt(int i, FILE* f)
+static inline void appendInt(int i, vector<char>* data)
 {
 #if defined( __BIG_ENDIAN__ ) || ( defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == 4321 )
   i = __builtin_bswap32(i);
 #endif
 
-  fwrite(&i, sizeof(i), 1, f);
+  const char* bytes = reinterpret_cast<const char*>(&i);
+  data->insert(data->end(), bytes, bytes + sizeof(i));
 }
 
 static inline void writeChars(const char* bytes, int count, FILE* f)
@@ -97,300 +184,425 @@ static inline void writeChars(const char* bytes, int count, FILE* f)
   fwrite(bytes, 1, size_t(count), f);
 }
 
-static void printError(FREE_IMAGE_FORMAT fif, const char* message)
+static inline void appendChars(const char* bytes, int count, vector<char>* data)
 {
-  printf("FreeImage(%s): %s\n", FreeImage_GetFormatFromFIF(fif), message);
+  data->insert(data->end(), bytes, bytes + count);
 }
 
-static FIBITMAP* createBitmap(const ImageData& image)
+// Temporary file next to the destination, unique among threads and processes writing it.
+static string tempFileFor(const char* destFile)
 {
-  FIBITMAP* dib = FreeImage_ConvertFromRawBits(reinterpret_cast<BYTE*>(image.pixels),
-                                               image.width, image.height, image.width * 4, 32,
-                                               FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK,
-                                               FI_RGBA_BLUE_MASK);
+  static atomic<int> counter(0);
 
-  // Convert RGBA -> BGRA.
-  int   size   = image.width * image.height * 4;
-  BYTE* pixels = FreeImage_GetBits(dib);
+  return string(destFile) + "." + to_string(getpid()) + "." + to_string(counter++) + ".tmp";
+}
 
-  for (int i = 0; i < size; i += 4) {
-    BYTE temp = pixels[i + 0];
+// Close a finished temporary file and move it over the destination. The destination is replaced
+// atomically, so readers (e.g. a running game) never see a partially written texture.
+static bool commitFile(FILE* f, const string& tempFile, const char* destFile)
+{
+  bool isWritten = ferror(f) == 0;
 
-    pixels[i + 0] = pixels[i + 2];
-    pixels[i + 2] = temp;
-  }
+  isWritten &= fclose(f) == 0;
 
-  if (dib == nullptr) {
-    printf("FreeImage_ConvertFromRawBits failed to build image.\n");
+#ifdef _WIN32
+  // Windows `rename()` does not overwrite existing files.
+  isWritten = isWritten && (remove(destFile) == 0 || errno == ENOENT);
+#endif
+
+  if (!isWritten || rename(tempFile.c_str(), destFile) != 0) {
+    printf("Failed to write '%s'.\n", destFile);
+    remove(tempFile.c_str());
+    return false;
   }
+  return true;
+}
 
-  FreeImage_SetTransparent(dib, image.flags & ImageData::ALPHA_BIT);
-  return dib;
+static inline int getInt(const char* data)
+{
+  int i;
+  memcpy(&i, data, sizeof(i));
+
+#if defined( __BIG_ENDIAN__ ) || ( defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == 4321 )
+  i = __builtin_bswap32(i);
+#endif
+  return i;
 }
 
-static FIBITMAP* loadBitmap(const char* file)
+static inline void setInt(int i, char* data)
 {
-  FREE_IMAGE_FORMAT format = FreeImage_GetFileType(file);
-  FIBITMAP*         dib    = FreeImage_Load(format < 0 ? FIF_TARGA : format, file);
+#if defined( __BIG_ENDIAN__ ) || ( defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == 4321 )
+  i = __builtin_bswap32(i);
+#endif
 
-  if (dib == nullptr) {
-    return nullptr;
+  memcpy(data, &i, sizeof(i));
+}
+
+static bool parseDDSHeader(const char* data, int size, DDSHeader* header)
+{
+  // Implementation is based on specifications from
+  // http://msdn.microsoft.com/en-us/library/windows/desktop/bb943991%28v=vs.85%29.aspx.
+  if (size < DDS_HEADER_SIZE || memcmp(data, "DDS ", 4) != 0) {
+    return false;
   }
 
-  FIBITMAP* oldDib = dib;
-  dib = FreeImage_ConvertTo32Bits(dib);
-  FreeImage_Unload(oldDib);
+  header->flags      = getInt(data + 8);
+  header->height     = getInt(data + 12);
+  header->width      = getInt(data + 16);
+  header->nMipmaps   = getInt(data + 28);
+  header->nFaces     = 1;
+  header->pixelFlags = getInt(data + 80);
+  header->bpp        = getInt(data + 88);
+  header->masks[0]   = unsigned(getInt(data + 92));
+  header->masks[1]   = unsigned(getInt(data + 96));
+  header->masks[2]   = unsigned(getInt(data + 100));
+  header->masks[3]   = unsigned(getInt(data + 104));
+  header->caps2      = getInt(data + 112);
+  header->dxgiFormat = 0;
+  header->format     = DDS_UNKNOWN;
+  header->blockSize  = 0;
+  header->dataOffset = DDS_HEADER_SIZE;
+
+  memcpy(header->fourCC, data + 84, 4);
+  header->fourCC[4] = '\0';
+
+  if (!(unsigned(header->flags) & DDSD_MIPMAPCOUNT) || header->nMipmaps < 1) {
+    header->nMipmaps = 1;
+  }
+  if (unsigned(header->caps2) & DDSCAPS2_CUBEMAP) {
+    header->nFaces = 6;
+  }
+  if (header->width <= 0 || header->height <= 0) {
+    return false;
+  }
 
-  // Remove alpha if unused.
-  int   width    = int(FreeImage_GetWidth(dib));
-  int   height   = int(FreeImage_GetHeight(dib));
-  int   size     = width * height * 4;
-  bool  hasAlpha = false;
-  BYTE* pixels   = FreeImage_GetBits(dib);
+  // Corrupt headers must not make level loops run past the 1x1 level.
+  header->nMipmaps = min(header->nMipmaps, mipmapCount(header->width, header->height, true));
+
+  unsigned pixelFlags = unsigned(header->pixelFlags);
+
+  if (pixelFlags & DDPF_FOURCC) {
+    if (memcmp(header->fourCC, "DX10", 4) == 0) {
+      if (size < DDS_DX10_HEADER_SIZE) {
+        return false;
+      }
+
+      int miscFlags = getInt(data + 136);
+
+      header->dxgiFormat = getInt(data + 128);
+      header->nFaces     = max(getInt(data + 140), 1);
+      header->nFaces    *= unsigned(miscFlags) & D3D10_RESOURCE_MISC_TEXTURECUBE ? 6 : 1;
+      header->dataOffset = DDS_DX10_HEADER_SIZE;
 
-  for (int i = 0; i < size; i += 4) {
-    if (pixels[i + 3] != 255) {
-      hasAlpha = true;
-      break;
+      switch (header->dxgiFormat) {
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC1_UNORM_SRGB: {
+          header->format = DDS_DXT1;
+          break;
+        }
+        case DXGI_FORMAT_BC2_UNORM:
+        case DXGI_FORMAT_BC2_UNORM_SRGB: {
+          header->format = DDS_DXT3;
+          break;
+        }
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC3_UNORM_SRGB: {
+          header->format = DDS_DXT5;
+          break;
+        }
+        case DXGI_FORMAT_BC7_TYPELESS:
+        case DXGI_FORMAT_BC7_UNORM:
+        case DXGI_FORMAT_BC7_UNORM_SRGB: {
+          header->format = DDS_BC7;
+          break;
+        }
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+        case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: {
+          header->format   = DDS_UNCOMPRESSED;
+          header->bpp      = 32;
+          header->masks[0] = 0x000000ff;
+          header->masks[1] = 0x0000ff00;
+          header->masks[2] = 0x00ff0000;
+          header->masks[3] = 0xff000000;
+          break;
+        }
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8X8_UNORM: {
+          header->format   = DDS_UNCOMPRESSED;
+          header->bpp      = 32;
+          header->masks[0] = 0x00ff0000;
+          header->masks[1] = 0x0000ff00;
+          header->masks[2] = 0x000000ff;
+          header->masks[3] = header->dxgiFormat == DXGI_FORMAT_B8G8R8A8_UNORM ? 0xff000000 : 0;
+          break;
+        }
+        default: {
+          // Other block-compressed formats can't be decoded but their size is still known.
+          if (DXGI_FORMAT_BC4_TYPELESS <= unsigned(header->dxgiFormat) &&
+              unsigned(header->dxgiFormat) <= DXGI_FORMAT_BC4_SNORM)
+          {
+            header->blockSize = 8;
+          }
+          else if ((DXGI_FORMAT_BC5_TYPELESS <= unsigned(header->dxgiFormat) &&
+                    unsigned(header->dxgiFormat) <= DXGI_FORMAT_BC5_SNORM) ||
+                   (DXGI_FORMAT_BC6H_TYPELESS <= unsigned(header->dxgiFormat) &&
+                    unsigned(header->dxgiFormat) < DXGI_FORMAT_BC7_TYPELESS))
+          {
+            header->blockSize = 16;
+          }
+          break;
+        }
+      }
+    }
+    else if (memcmp(header->fourCC, "DXT1", 4) == 0) {
+      header->format = DDS_DXT1;
+    }
+    else if (memcmp(header->fourCC, "DXT3", 4) == 0) {
+      header->format = DDS_DXT3;
+    }
+    else if (memcmp(header->fourCC, "DXT5", 4) == 0) {
+      header->format = DDS_DXT5;
     }
   }
-  if (!hasAlpha) {
-    FreeImage_SetTransparent(dib, false);
+  else if (pixelFlags & (DDPF_RGB | DDPF_LUMINANCE)) {
+    if (header->bpp == 8 || header->bpp == 16 || header->bpp == 24 || header->bpp == 32) {
+      header->format = DDS_UNCOMPRESSED;
+    }
   }
 
-  FreeImage_FlipVertical(dib);
-  return dib;
+  if (header->format == DDS_DXT1) {
+    header->blockSize = 8;
+  }
+  else if (header->format == DDS_DXT3 || header->format == DDS_DXT5 || header->format == DDS_BC7) {
+    header->blockSize = 16;
+  }
+  return true;
 }
 
-static bool buildDDS(const ImageData* faces, int nFaces, int options,double scale,
-                     const char* destFile)
+static bool readDDSHeader(FILE* f, DDSHeader* header)
 {
-  assert(nFaces > 0);
+  char data[DDS_DX10_HEADER_SIZE];
+  int  size = int(fread(data, 1, sizeof(data), f));
 
-  int width      = faces[0].width;
-  int height     = faces[0].height;
+  return parseDDSHeader(data, size, header);
+}
 
-  bool isCubeMap = options & ImageBuilder::CUBE_MAP_BIT;
-  bool isNormal  = options & ImageBuilder::NORMAL_MAP_BIT;
-  bool doMipmaps = options & ImageBuilder::MIPMAPS_BIT;
-  bool compress  = options & ImageBuilder::COMPRESSION_BIT;
-  bool doFlip    = options & ImageBuilder::FLIP_BIT;
-  bool doFlop    = options & ImageBuilder::FLOP_BIT;
-  bool doYYYX    = options & ImageBuilder::YYYX_BIT;
-  bool doZYZX    = options & ImageBuilder::ZYZX_BIT;
-  bool hasAlpha  = (faces[0].flags & ImageData::ALPHA_BIT) || doYYYX || doZYZX;
-  bool isArray   = !isCubeMap && nFaces > 1;
+static int ddsLevelSize(const DDSHeader& header, int width, int height)
+{
+  if (header.blockSize != 0) {
+    return max(1, (width + 3) / 4) * max(1, (height + 3) / 4) * header.blockSize;
+  }
+  return width * height * header.bpp / 8;
+}
 
-  for (int i = 1; i < nFaces; ++i) {
-    if (faces[i].width != width || faces[i].height != height) {
-      printf("All faces must have the same dimensions.\n");
-      return false;
+static const char* ddsFormatName(const DDSHeader& header)
+{
+  if (header.dxgiFormat != 0) {
+    switch (header.format) {
+      case DDS_DXT1: {
+        return "BC1 ";
+      }
+      case DDS_DXT3: {
+        return "BC2 ";
+      }
+      case DDS_DXT5: {
+        return "BC3 ";
+      }
+      case DDS_BC7: {
+        return "BC7 ";
+      }
+      case DDS_UNCOMPRESSED: {
+        return header.masks[3] != 0 ? "RGBA" : "RGB ";
+      }
+      default: {
+        return header.fourCC;
+      }
     }
   }
-
-  if (isCubeMap && nFaces != 6) {
-    printf("Cube map requires exactly 6 faces.\n");
-    return false;
+  else if (unsigned(header.pixelFlags) & DDPF_FOURCC) {
+    return header.fourCC;
   }
+  else {
+    return header.bpp == 32 ? "RGBA" : "RGB ";
+  }
+}
 
-  int targetWidth    = max(int(lround(width * scale)), 1);
-  int targetHeight   = max(int(lround(height * scale)), 1);
-  int targetBPP      = hasAlpha || compress || isArray ? 32 : 24;
-  int pitchOrLinSize = ((targetWidth * targetBPP / 8 + 3) / 4) * 4;
-  int nMipmaps       = doMipmaps ? index1(max(targetWidth, targetHeight)) + 1 : 1;
-
-  int flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
-  flags |= doMipmaps ? DDSD_MIPMAPCOUNT : 0;
-  flags |= compress  ? DDSD_LINEARSIZE  : DDSD_PITCH;
+static inline BYTE extractChannel(unsigned pixel, unsigned mask)
+{
+  if (mask == 0) {
+    return 255;
+  }
 
-  int caps = DDSCAPS_TEXTURE;
-  caps |= doMipmaps ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0;
-  caps |= isCubeMap ? DDSCAPS_COMPLEX : 0;
+  int      shift    = __builtin_ctz(mask);
+  unsigned maxValue = mask >> shift;
 
-  int caps2 = isCubeMap ? DDSCAPS2_CUBEMAP : 0;
-  caps2 |= isCubeMap ? DDSCAPS2_CUBEMAP_POSITIVEX | DDSCAPS2_CUBEMAP_NEGITIVEX : 0;
-  caps2 |= isCubeMap ? DDSCAPS2_CUBEMAP_POSITIVEY | DDSCAPS2_CUBEMAP_NEGITIVEY : 0;
-  caps2 |= isCubeMap ? DDSCAPS2_CUBEMAP_POSITIVEZ | DDSCAPS2_CUBEMAP_NEGITIVEZ : 0;
+  return BYTE(((pixel & mask) >> shift) * 255 / maxValue);
+}
 
-  int pixelFlags = 0;
-  pixelFlags |= hasAlpha ? DDPF_ALPHAPIXELS : 0;
-  pixelFlags |= compress ? DDPF_FOURCC : DDPF_RGB;
-  pixelFlags |= isNormal ? DDPF_NORMAL : 0;
+static ImageData decodeDDS(const char* file, const vector<char>& data)
+{
+  ImageData image;
+  DDSHeader header;
 
-  const char* fourCC = isArray ? "DX10" : "\0\0\0\0";
-  int dx10Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+  if (!parseDDSHeader(data.data(), int(data.size()), &header)) {
+    return image;
+  }
+  // BC7 is only written, there is no decoder for it.
+  if (header.format == DDS_UNKNOWN || header.format == DDS_BC7) {
+    printf("Unsupported DDS pixel format in '%s'.\n", file);
+    return image;
+  }
 
-  int squishFlags = squish::kColourIterativeClusterFit | squish::kWeightColourByAlpha;
-  squishFlags    |= hasAlpha ? squish::kDxt5 : squish::kDxt1;
+  // Only the base level of the first face is loaded.
+  int levelSize = ddsLevelSize(header, header.width, header.height);
 
-  if (compress) {
-    pitchOrLinSize = squish::GetStorageRequirements(targetWidth, targetHeight, squishFlags);
-    dx10Format     = hasAlpha ? DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_BC1_UNORM;
-    fourCC         = isArray ? "DX10" : hasAlpha ? "DXT5" : "DXT1";
+  if (int(data.size()) - header.dataOffset < levelSize) {
+    printf("Truncated DDS file '%s'.\n", file);
+    return image;
   }
 
-  FILE* f = fopen(destFile, "wb");
+  image = ImageData(header.width, header.height);
 
-  if (f == nullptr) {
-    printf("Failed to open for writing '%s'.\n", destFile);
-    return false;
-  }
+  if (header.format == DDS_UNCOMPRESSED) {
+    bool         isLuminance = !(unsigned(header.pixelFlags) & DDPF_RGB) && header.dxgiFormat == 0;
+    int          pixelSize   = header.bpp / 8;
+    int          size        = header.width * header.height;
+    const BYTE*  src         = reinterpret_cast<const BYTE*>(&data[size_t(header.dataOffset)]);
+    char*        dest        = image.pixels;
+    unsigned     alphaMask   = (unsigned(header.pixelFlags) & DDPF_ALPHAPIXELS) ||
+                               header.dxgiFormat != 0 ? header.masks[3] : 0;
 
-  // Header beginning.
-  writeChars("DDS ", 4, f);
-  writeInt(124, f);
-  writeInt(flags, f);
-  writeInt(targetHeight, f);
-  writeInt(targetWidth, f);
-  writeInt(pitchOrLinSize, f);
-  writeInt(0, f);
-  writeInt(nMipmaps, f);
+    for (int i = 0; i < size; ++i) {
+      unsigned pixel = 0;
 
-  // Reserved int[11].
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
+      for (int j = 0; j < pixelSize; ++j) {
+        pixel |= unsigned(src[j]) << (j * 8);
+      }
 
-  // Pixel format.
-  writeInt(32, f);
-  writeInt(pixelFlags, f);
-  writeChars(fourCC, 4, f);
+      dest[0] = char(extractChannel(pixel, header.masks[0]));
+      dest[1] = isLuminance ? dest[0] : char(extractChannel(pixel, header.masks[1]));
+      dest[2] = isLuminance ? dest[0] : char(extractChannel(pixel, header.masks[2]));
+      dest[3] = char(extractChannel(pixel, alphaMask));
 
-  if (compress) {
-    writeInt(0, f);
-    writeInt(0, f);
-    writeInt(0, f);
-    writeInt(0, f);
-    writeInt(0, f);
+      src  += pixelSize;
+      dest += 4;
+    }
   }
   else {
-    writeInt(targetBPP, f);
-    writeInt(0x00ff0000, f);
-    writeInt(0x0000ff00, f);
-    writeInt(0x000000ff, f);
-    writeInt(int(0xff000000), f);
+    int squishFlags = header.format == DDS_DXT1 ? squish::kDxt1 :
+                      header.format == DDS_DXT3 ? squish::kDxt3 : squish::kDxt5;
+
+    squish::DecompressImage(reinterpret_cast<squish::u8*>(image.pixels), header.width,
+                            header.height, &data[size_t(header.dataOffset)], squishFlags);
   }
 
-  writeInt(caps, f);
-  writeInt(caps2, f);
-  writeInt(0, f);
-  writeInt(0, f);
-  writeInt(0, f);
+  image.determineAlpha();
 
-  if (isArray) {
-    writeInt(dx10Format, f);
-    writeInt(D3D10_RESOURCE_DIMENSION_TEXTURE2D, f);
-    writeInt(0, f);
-    writeInt(nFaces, f);
-    writeInt(0, f);
+  if (unsigned(header.pixelFlags) & DDPF_NORMAL) {
+    image.flags |= ImageData::NORMAL_BIT;
   }
+  return image;
+}
 
-  vector<char> buffer;
+static ImageData decodeMBM(const char* file, const vector<char>& data)
+{
+  ImageData image;
 
-  for (int i = 0; i < nFaces; ++i) {
-    FIBITMAP* face = createBitmap(faces[i]);
+  if (data.size() < 20 || getInt(&data[0]) != 0x50534B03) {
+    return image;
+  }
 
-    if (doFlip) {
-      FreeImage_FlipVertical(face);
-    }
-    if (doFlop) {
-      FreeImage_FlipHorizontal(face);
-    }
+  int width     = getInt(&data[4]);
+  int height    = getInt(&data[8]);
+  int type      = getInt(&data[12]);
+  int bpp       = getInt(&data[16]);
+  int pixelSize = bpp == 32 ? 4 : 3;
+
+  if (width <= 0 || height <= 0 ||
+      (int(data.size()) - 20) / pixelSize / width < height)
+  {
+    printf("Truncated MBM file '%s'.\n", file);
+    return image;
+  }
 
-    if (doYYYX) {
-      FreeImage_SetTransparent(face, true);
+  image = ImageData(width, height);
 
-      BYTE* pixels = FreeImage_GetBits(face);
-      int   size   = width * height * 4;
+  if (type != 0) {
+    image.flags |= ImageData::NORMAL_BIT;
+  }
 
-      for (int j = 0; j < size; j += 4) {
-        pixels[j + 3] = pixels[j + 2];
-        pixels[j + 0] = pixels[j + 1];
-        pixels[j + 2] = pixels[j + 1];
-      }
-    }
-    else if (doZYZX) {
-      FreeImage_SetTransparent(face, true);
+  const char* src = &data[20];
 
-      BYTE* pixels = FreeImage_GetBits(face);
-      int   size   = width * height * 4;
+  for (int i = height - 1; i >= 0; --i) {
+    for (int j = 0; j < width; ++j) {
+      int pos = (i * width + j) * 4;
 
-      for (int j = 0; j < size; j += 4) {
-        pixels[j + 3] = pixels[j + 2];
-        pixels[j + 2] = pixels[j + 0];
-      }
-    }
-    else if (compress) {
-      BYTE* pixels = FreeImage_GetBits(face);
-      int   size   = width * height * 4;
+      image.pixels[pos + 0] = src[0];
+      image.pixels[pos + 1] = src[1];
+      image.pixels[pos + 2] = src[2];
+      image.pixels[pos + 3] = char(bpp == 32 ? src[3] : 255);
 
-      for (int j = 0; j < size; j += 4) {
-        swap(pixels[j], pixels[j + 2]);
+      if (image.pixels[pos + 3] != char(255)) {
+        image.flags |= ImageData::ALPHA_BIT;
       }
+      src += pixelSize;
     }
+  }
+  return image;
+}
 
-    if (targetBPP == 24) {
-      face = FreeImage_ConvertTo24Bits(face);
-    }
-
-    int levelWidth  = targetWidth;
-    int levelHeight = targetHeight;
-
-    for (int j = 0; j < nMipmaps; ++j) {
-      FIBITMAP* level = face;
+static void printError(FREE_IMAGE_FORMAT fif, const char* message)
+{
+  printf("FreeImage(%s): %s\n", FreeImage_GetFormatFromFIF(fif), message);
+}
 
-      if (levelWidth != width || levelHeight != height) {
-        level = FreeImage_Rescale(face, levelWidth, levelHeight, FILTER_CATMULLROM);
-      }
+static FIBITMAP* createBitmap(const ImageData& image)
+{
+  FIBITMAP* dib = FreeImage_ConvertFromRawBits(reinterpret_cast<BYTE*>(image.pixels),
+                                               image.width, image.height, image.width * 4, 32,
+                                               FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK,
+                                               FI_RGBA_BLUE_MASK);
 
-      if (compress) {
-        BYTE* pixels = FreeImage_GetBits(level);
-        int   s3Size = squish::GetStorageRequirements(levelWidth, levelHeight, squishFlags);
+  // Convert RGBA -> BGRA.
+  Kernels::swapRB(FreeImage_GetBits(dib), image.width * image.height);
 
-        buffer.resize(size_t(s3Size));
-        squish::CompressImage(pixels, levelWidth, levelHeight, &buffer[0], squishFlags);
-        writeChars(&buffer[0], s3Size, f);
-      }
-      else {
-        const char* pixels = reinterpret_cast<const char*>(FreeImage_GetBits(level));
-        int         pitch  = int(FreeImage_GetPitch(level));
+  if (dib == nullptr) {
+    printf("FreeImage_ConvertFromRawBits failed to build image.\n");
+  }
 
-        for (int k = 0; k < levelHeight; ++k) {
-          writeChars(pixels, levelWidth * targetBPP / 8, f);
-          pixels += pitch;
-        }
-      }
+  FreeImage_SetTransparent(dib, image.flags & ImageData::ALPHA_BIT);
+  return dib;
+}
 
-      levelWidth  = max(1, levelWidth / 2);
-      levelHeight = max(1, levelHeight / 2);
+static FIBITMAP* decodeBitmap(const vector<char>& data)
+{
+  BYTE*             bytes  = reinterpret_cast<BYTE*>(const_cast<char*>(data.data()));
+  FIMEMORY*         memory = FreeImage_OpenMemory(bytes, DWORD(data.size()));
+  FREE_IMAGE_FORMAT format = FreeImage_GetFileTypeFromMemory(memory);
+  FIBITMAP*         dib    = FreeImage_LoadFromMemory(format < 0 ? FIF_TARGA : format, memory);
 
-      if (level != face) {
-        FreeImage_Unload(level);
-      }
-    }
+  FreeImage_CloseMemory(memory);
 
-    FreeImage_Unload(face);
+  if (dib == nullptr) {
+    return nullptr;
   }
 
-  fclose(f);
+  FIBITMAP* oldDib = dib;
+  dib = FreeImage_ConvertTo32Bits(dib);
+  FreeImage_Unload(oldDib);
 
-  printf("%s\n%s  %4dx%-4d  %2d mipmaps%s\n",
-         destFile,
-         compress ? fourCC : targetBPP == 32 ? "RGBA" : "RGB ",
-         targetWidth,
-         targetHeight,
-         nMipmaps,
-         isNormal ? "  NORMAL_MAP" : "");
+  // Remove alpha if unused.
+  int   width  = int(FreeImage_GetWidth(dib));
+  int   height = int(FreeImage_GetHeight(dib));
+  int   pitch  = int(FreeImage_GetPitch(dib));
+  BYTE* pixels = FreeImage_GetBits(dib);
 
-  return true;
+  if (!Kernels::hasAlpha(pixels, width * height)) {
+    FreeImage_SetTransparent(dib, false);
+  }
+
+  Kernels::flipVertical(pixels, width, height, pitch);
+  return dib;
 }
 
 ImageData::ImageData(int width_, int height_) :
@@ -435,15 +647,10 @@ void ImageData::determineAlpha()
     return;
   }
 
-  int size = width * height * 4;
-
   flags &= ~ALPHA_BIT;
 
-  for (int i = 0; i < size; i += 4) {
-    if (pixels[i + 3] != char(255)) {
-      flags |= ALPHA_BIT;
-      return;
-    }
+  if (Kernels::hasAlpha(reinterpret_cast<const BYTE*>(pixels), width * height)) {
+    flags |= ALPHA_BIT;
   }
 }
 
@@ -453,80 +660,231 @@ bool ImageData::isNormalMap() const
     return false;
   }
 
-  int   size       = width * height * 4;
-  float average[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-  for (int i = 0; i < size; i += 4) {
-    float c[4] = {
-      BYTE(pixels[i + 0]) / 255.0f - 0.5f,
-      BYTE(pixels[i + 1]) / 255.0f - 0.5f,
-      BYTE(pixels[i + 2]) / 255.0f - 0.5f,
-      BYTE(pixels[i + 3]) / 255.0f
-    };
+  return Kernels::isNormalMap(reinterpret_cast<const BYTE*>(pixels), width * height);
+}
 
-    float cSq = c[0]*c[0] + c[1]*c[1] + c[2]*c[2];
+bool ImageBuilder::readSize(const char* file, int* width, int* height, bool* hasAlpha)
+{
+  size_t pathLen = strlen(file);
 
-    if (abs(1.0f - cSq) > 0.8f || c[3] < 0.9f) {
+  if (isDDSFile(file)) {
+    FILE* f = fopen(file, "rb");
+    if (f == nullptr) {
       return false;
     }
 
-    average[0] += c[0];
-    average[1] += c[1];
-    average[2] += c[2];
-    average[3] += c[3];
-  }
+    DDSHeader header;
+    bool      isValid = readDDSHeader(f, &header);
 
-  average[0] /= float(width * height);
-  average[1] /= float(width * height);
-  average[2] /= float(width * height);
-  average[3] /= float(width * height);
+    fclose(f);
 
-  average[2] -= 0.5f;
+    if (!isValid) {
+      return false;
+    }
 
-  return average[0]*average[0] + average[1]*average[1] + average[2]*average[2] < 0.1f;
-}
+    *width  = header.width;
+    *height = header.height;
 
-ImageData ImageBuilder::loadImage(const char* file)
-{
-  ImageData image;
-  size_t    pathLen = strlen(file);
-
-  if (strcmp(file + pathLen - 3, "mbm") == 0) {
+    if (hasAlpha != nullptr) {
+      *hasAlpha = header.format == DDS_DXT3 || header.format == DDS_DXT5 ||
+                  header.format == DDS_BC7 ||
+                  (header.format == DDS_UNCOMPRESSED &&
+                   ((unsigned(header.pixelFlags) & DDPF_ALPHAPIXELS) || header.dxgiFormat != 0) &&
+                   header.masks[3] != 0);
+    }
+    return true;
+  }
+  else if (strcmp(file + pathLen - 3, "mbm") == 0) {
     FILE* f = fopen(file, "rb");
-    if (f == nullptr || readInt(f) != 0x50534B03) {
-      return image;
+    if (f == nullptr) {
+      return false;
     }
 
-    int width  = readInt(f);
-    int height = readInt(f);
-    int type   = readInt(f);
-    int bpp    = readInt(f);
+    bool isValid = readInt(f) == 0x50534B03;
 
-    image = ImageData(width, height);
+    *width  = readInt(f);
+    *height = readInt(f);
 
-    if (type != 0) {
-      image.flags |= ImageData::NORMAL_BIT;
+    readInt(f);
+
+    if (hasAlpha != nullptr) {
+      *hasAlpha = readInt(f) == 32;
     }
 
-    for (int i = height - 1; i >= 0; --i) {
-      for (int j = 0; j < width; ++j) {
-        int pos = (i * width + j) * 4;
+    fclose(f);
+    return isValid;
+  }
+  else {
+    FREE_IMAGE_FORMAT format = FreeImage_GetFileType(file);
+    FIBITMAP*         dib    = FreeImage_Load(format < 0 ? FIF_TARGA : format, file,
+                                              FIF_LOAD_NOPIXELS);
+    if (dib == nullptr) {
+      return false;
+    }
 
-        image.pixels[pos + 0] = char(fgetc(f));
-        image.pixels[pos + 1] = char(fgetc(f));
-        image.pixels[pos + 2] = char(fgetc(f));
-        image.pixels[pos + 3] = char(bpp == 32 ? fgetc(f) : 255);
+    *width  = int(FreeImage_GetWidth(dib));
+    *height = int(FreeImage_GetHeight(dib));
 
-        if (image.pixels[pos + 3] != char(255)) {
-          image.flags |= ImageData::ALPHA_BIT;
-        }
-      }
+    if (hasAlpha != nullptr) {
+      *hasAlpha = FreeImage_GetBPP(dib) == 32 || FreeImage_IsTransparent(dib);
+    }
+
+    FreeImage_Unload(dib);
+    return true;
+  }
+}
+
+size_t ImageBuilder::estimateSize(int width, int height, bool hasAlpha, int options, double scale)
+{
+  bool doMipmaps    = options & MIPMAPS_BIT;
+  bool isBC7        = options & BC7_BIT;
+  bool compress     = options & COMPRESSION_BIT || isBC7;
+  bool doSwizzle    = options & (YYYX_BIT | ZYZX_BIT);
+  int  targetWidth  = scaledSize(width, scale);
+  int  targetHeight = scaledSize(height, scale);
+  int  targetBPP    = hasAlpha || doSwizzle || compress ? 32 : 24;
+  int  nMipmaps     = mipmapCount(targetWidth, targetHeight, doMipmaps);
+  int  squishFlags  = squishFlagsFor(hasAlpha || doSwizzle || isBC7);
+  int  levelWidth   = targetWidth;
+  int  levelHeight  = targetHeight;
+
+  size_t size = 0;
+
+  for (int i = 0; i < nMipmaps; ++i) {
+    if (compress) {
+      size += size_t(squish::GetStorageRequirements(levelWidth, levelHeight, squishFlags));
+    }
+    else {
+      size += size_t(levelWidth) * size_t(levelHeight) * size_t(targetBPP / 8);
     }
 
+    levelWidth  = max(1, levelWidth / 2);
+    levelHeight = max(1, levelHeight / 2);
+  }
+  return size;
+}
+
+size_t ImageBuilder::estimateMemory(int width, int height, int options, double scale)
+{
+  bool compress     = options & (COMPRESSION_BIT | BC7_BIT);
+  int  targetWidth  = scaledSize(width, scale);
+  int  targetHeight = scaledSize(height, scale);
+
+  size_t imageSize  = size_t(width) * size_t(height) * 4;
+  size_t levelSize  = size_t(targetWidth) * size_t(targetHeight) * 4;
+
+  // While decoding, file contents (assumed to be at most half of raw pixels), FreeImage 32-bit
+  // bitmap and `ImageData` coexist. During `prepareDDS()` the caller's `ImageData` is kept alive
+  // beside FreeImage copy, 24-bit conversion of the copy (for opaque uncompressed output), the
+  // rescaled level and all levels generated so far (4/3 of the top one), which are later replaced
+  // by compressed blocks one by one.
+  size_t loadPeak   = 2 * imageSize + imageSize / 2;
+  size_t buildPeak  = 2 * imageSize + levelSize + levelSize * 4 / 3;
+
+  buildPeak += compress ? levelSize / 4 : imageSize * 3 / 4;
+
+  return max(loadPeak, buildPeak);
+}
+
+bool ImageBuilder::readTextureInfo(const char* file, TextureInfo* info)
+{
+  if (isDDSFile(file)) {
+    FILE* f = fopen(file, "rb");
+    if (f == nullptr) {
+      return false;
+    }
+
+    // Unbuffered, so only the header is read from disk.
+    setvbuf(f, nullptr, _IONBF, 0);
+
+    DDSHeader header;
+    bool      isValid = readDDSHeader(f, &header);
+
     fclose(f);
+
+    if (!isValid) {
+      return false;
+    }
+
+    info->width    = header.width;
+    info->height   = header.height;
+    info->nMipmaps = header.nMipmaps;
+    info->nFaces   = header.nFaces;
+    info->memory   = 0;
+
+    snprintf(info->format, sizeof(info->format), "%s", ddsFormatName(header));
+
+    char* space = strchr(info->format, ' ');
+    if (space != nullptr) {
+      *space = '\0';
+    }
+
+    for (int i = 0; i < header.nMipmaps; ++i) {
+      info->memory += size_t(ddsLevelSize(header, max(header.width >> i, 1),
+                                          max(header.height >> i, 1)));
+    }
+    info->memory *= size_t(header.nFaces);
   }
   else {
-    FIBITMAP* dib = loadBitmap(file);
+    if (!readSize(file, &info->width, &info->height)) {
+      return false;
+    }
+
+    // Other images are uploaded as uncompressed RGBA, assume the driver generates mipmaps.
+    info->nMipmaps = index1(max(info->width, info->height)) + 1;
+    info->nFaces   = 1;
+    info->memory   = 0;
+
+    const char* dot = strrchr(file, '.');
+    snprintf(info->format, sizeof(info->format), "%s", dot == nullptr ? "?" : dot + 1);
+
+    for (int i = 0; i < info->nMipmaps; ++i) {
+      info->memory += size_t(max(info->width >> i, 1)) * size_t(max(info->height >> i, 1)) * 4;
+    }
+  }
+  return true;
+}
+
+bool ImageBuilder::isDDSFile(const char* file)
+{
+  size_t pathLen = strlen(file);
+
+  return pathLen >= 4 && (strcmp(file + pathLen - 4, ".dds") == 0 ||
+                          strcmp(file + pathLen - 4, ".DDS") == 0);
+}
+
+bool ImageBuilder::readFile(const char* file, vector<char>* data)
+{
+  FILE* f = fopen(file, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  data->resize(size_t(max(size, 0L)));
+
+  bool isComplete = size >= 0 && fread(data->data(), 1, data->size(), f) == data->size();
+  fclose(f);
+
+  return isComplete;
+}
+
+ImageData ImageBuilder::decodeImage(const char* file, const vector<char>& data)
+{
+  ImageData image;
+  size_t    pathLen = strlen(file);
+
+  if (isDDSFile(file)) {
+    image = decodeDDS(file, data);
+  }
+  else if (strcmp(file + pathLen - 3, "mbm") == 0) {
+    image = decodeMBM(file, data);
+  }
+  else if (!ImageDecoder::decode(file, data, &image)) {
+    FIBITMAP* dib = decodeBitmap(data);
     if (dib == nullptr) {
       return image;
     }
@@ -534,15 +892,8 @@ ImageData ImageBuilder::loadImage(const char* file)
     image = ImageData(int(FreeImage_GetWidth(dib)), int(FreeImage_GetHeight(dib)));
 
     // Copy and convert BGRA -> RGBA.
-    int   size   = image.width * image.height * 4;
-    BYTE* pixels = FreeImage_GetBits(dib);
-
-    for (int i = 0; i < size; i += 4) {
-      image.pixels[i + 0] = char(pixels[i + 2]);
-      image.pixels[i + 1] = char(pixels[i + 1]);
-      image.pixels[i + 2] = char(pixels[i + 0]);
-      image.pixels[i + 3] = char(pixels[i + 3]);
-    }
+    Kernels::copySwapRB(reinterpret_cast<BYTE*>(image.pixels), FreeImage_GetBits(dib),
+                        image.width * image.height);
 
     if (FreeImage_IsTransparent(dib)) {
       image.flags |= ImageData::ALPHA_BIT;
@@ -553,6 +904,16 @@ ImageData ImageBuilder::loadImage(const char* file)
   return image;
 }
 
+ImageData ImageBuilder::loadImage(const char* file)
+{
+  vector<char> data;
+
+  if (!readFile(file, &data)) {
+    return ImageData();
+  }
+  return decodeImage(file, data);
+}
+
 bool ImageBuilder::printInfo(const char* file)
 {
   FILE* f = fopen(file, "rb");
@@ -560,69 +921,533 @@ bool ImageBuilder::printInfo(const char* file)
     return false;
   }
 
-  // Implementation is based on specifications from
-  // http://msdn.microsoft.com/en-us/library/windows/desktop/bb943991%28v=vs.85%29.aspx.
-  char magic[4];
-  fread(magic, 4, 1, f);
+  DDSHeader header;
+  bool      isValid = readDDSHeader(f, &header);
+
+  fclose(f);
+
+  if (!isValid) {
+    return false;
+  }
+
+  printf("%s\n%s  %4dx%-4d  %2d mipmaps%s",
+         file,
+         ddsFormatName(header),
+         header.width,
+         header.height,
+         header.nMipmaps,
+         unsigned(header.pixelFlags) & DDPF_NORMAL ? "  NORMAL_MAP" : "");
+
+  if (header.nFaces > 1) {
+    printf("  %d faces", header.nFaces);
+  }
+  printf("\n");
+
+  return true;
+}
+
+int ImageBuilder::mipmapLevel(const char* file, double scale)
+{
+  FILE* f = fopen(file, "rb");
+  if (f == nullptr) {
+    return -1;
+  }
+
+  DDSHeader header;
+  bool      isValid = readDDSHeader(f, &header);
+
+  fclose(f);
+
+  if (!isValid || header.format == DDS_UNKNOWN) {
+    return -1;
+  }
+
+  int targetWidth  = max(int(lround(header.width * scale)), 1);
+  int targetHeight = max(int(lround(header.height * scale)), 1);
+
+  for (int i = 0; i < header.nMipmaps; ++i) {
+    if (max(header.width >> i, 1) == targetWidth && max(header.height >> i, 1) == targetHeight) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool ImageBuilder::dropMipmaps(const char* file, int nLevels, const char* destFile)
+{
+  FILE* f = fopen(file, "rb");
+  if (f == nullptr) {
+    printf("Failed to open '%s'.\n", file);
+    return false;
+  }
+
+  char      headerData[DDS_DX10_HEADER_SIZE];
+  int       headerSize = int(fread(headerData, 1, sizeof(headerData), f));
+  DDSHeader header;
+
+  if (!parseDDSHeader(headerData, headerSize, &header) || header.format == DDS_UNKNOWN ||
+      nLevels < 0 || nLevels >= header.nMipmaps)
+  {
+    printf("Cannot drop %d mipmap levels from '%s'.\n", nLevels, file);
+    fclose(f);
+    return false;
+  }
+
+  string tempFile = tempFileFor(destFile);
+  FILE*  out      = fopen(tempFile.c_str(), "wb");
 
-  if (memcmp(magic, "DDS ", 4) != 0) {
+  if (out == nullptr) {
+    printf("Failed to open for writing '%s'.\n", destFile);
+    fclose(f);
     return false;
   }
 
-  readInt(f);
+  int targetWidth  = max(header.width >> nLevels, 1);
+  int targetHeight = max(header.height >> nLevels, 1);
+  int nMipmaps     = header.nMipmaps - nLevels;
+  int pitch        = header.format == DDS_UNCOMPRESSED ? targetWidth * header.bpp / 8 :
+                     ddsLevelSize(header, targetWidth, targetHeight);
+
+  setInt(targetHeight, headerData + 12);
+  setInt(targetWidth, headerData + 16);
+  setInt(pitch, headerData + 20);
+  setInt(nMipmaps, headerData + 28);
 
-  int flags  = readInt(f);
-  int height = readInt(f);
-  int width  = readInt(f);
+  writeChars(headerData, header.dataOffset, out);
 
-  readInt(f);
-  readInt(f);
+  // Faces are stored one after another, each with its complete mipmap chain. Compressed blocks of
+  // the remaining levels are copied verbatim.
+  int  dropSize = 0;
+  int  keepSize = 0;
+  bool isValid  = true;
 
-  int nMipmaps = readInt(f);
+  for (int i = 0; i < header.nMipmaps; ++i) {
+    int levelSize = ddsLevelSize(header, max(header.width >> i, 1), max(header.height >> i, 1));
 
-  if (!(unsigned(flags) & DDSD_MIPMAPCOUNT)) {
-    nMipmaps = 1;
+    if (i < nLevels) {
+      dropSize += levelSize;
+    }
+    else {
+      keepSize += levelSize;
+    }
   }
 
-  fseek(f, 4 + 76, SEEK_SET);
+  vector<char> buffer(static_cast<size_t>(keepSize));
 
-  int pixelFlags = readInt(f);
+  fseek(f, header.dataOffset, SEEK_SET);
 
-  char formatFourCC[5] = {};
-  fread(formatFourCC, 4, 1, f);
+  for (int i = 0; i < header.nFaces && isValid; ++i) {
+    fseek(f, dropSize, SEEK_CUR);
 
-  int bpp = readInt(f);
+    isValid = fread(&buffer[0], 1, buffer.size(), f) == buffer.size();
+    writeChars(&buffer[0], keepSize, out);
+  }
 
-  readInt(f);
-  readInt(f);
-  readInt(f);
-  readInt(f);
-  readInt(f);
+  fclose(f);
+
+  if (!isValid) {
+    printf("Truncated DDS file '%s'.\n", file);
+    fclose(out);
+    remove(tempFile.c_str());
+    return false;
+  }
+  if (!commitFile(out, tempFile, destFile)) {
+    return false;
+  }
 
   printf("%s\n%s  %4dx%-4d  %2d mipmaps%s\n",
-         file,
-         unsigned(pixelFlags) & DDPF_FOURCC ? formatFourCC : bpp == 32 ? "RGBA" : "RGB ",
-         width,
-         height,
+         destFile,
+         ddsFormatName(header),
+         targetWidth,
+         targetHeight,
          nMipmaps,
-         unsigned(pixelFlags) & DDPF_NORMAL ? "  NORMAL_MAP" : "");
+         unsigned(header.pixelFlags) & DDPF_NORMAL ? "  NORMAL_MAP" : "");
 
   return true;
 }
 
-bool ImageBuilder::createDDS(const ImageData* faces, int nFaces, int options, double scale,
-                             const char* destFile)
+void ImageBuilder::setRDOError(double maxError)
+{
+  rdoError = max(maxError, 0.0);
+}
+
+void ImageBuilder::setBC7Options(int speed, int nThreads)
+{
+  bc7Speed   = min(max(speed, BC7Encoder::FAST), BC7Encoder::BEST);
+  bc7Threads = max(nThreads, 1);
+}
+
+int ImageBuilder::optionsFor(const ImageData& image, int options)
+{
+  if (image.flags & ImageData::NORMAL_BIT) {
+    options |= NORMAL_MAP_BIT;
+    options &= ~(YYYX_BIT | ZYZX_BIT);
+  }
+  return options;
+}
+
+bool ImageBuilder::prepareDDS(const ImageData* faces, int nFaces, int options, double scale,
+                              DDSData* dds)
 {
   if (nFaces < 1) {
     printf("At least one face must be given.\n");
     return false;
   }
 
-  return buildDDS(faces, nFaces, options, scale, destFile);
+  int width      = faces[0].width;
+  int height     = faces[0].height;
+
+  bool isCubeMap = options & ImageBuilder::CUBE_MAP_BIT;
+  bool isNormal  = options & ImageBuilder::NORMAL_MAP_BIT;
+  bool doMipmaps = options & ImageBuilder::MIPMAPS_BIT;
+  bool isBC7     = options & ImageBuilder::BC7_BIT;
+  bool compress  = options & ImageBuilder::COMPRESSION_BIT || isBC7;
+  bool doFlip    = options & ImageBuilder::FLIP_BIT;
+  bool doFlop    = options & ImageBuilder::FLOP_BIT;
+  bool doYYYX    = options & ImageBuilder::YYYX_BIT;
+  bool doZYZX    = options & ImageBuilder::ZYZX_BIT;
+  bool isPreview = options & ImageBuilder::PREVIEW_BIT;
+  bool hasAlpha  = (faces[0].flags & ImageData::ALPHA_BIT) || doYYYX || doZYZX;
+  bool isArray   = !isCubeMap && nFaces > 1;
+  bool isDX10    = isArray || isBC7;
+
+  for (int i = 1; i < nFaces; ++i) {
+    if (faces[i].width != width || faces[i].height != height) {
+      printf("All faces must have the same dimensions.\n");
+      return false;
+    }
+  }
+
+  if (isCubeMap && nFaces != 6) {
+    printf("Cube map requires exactly 6 faces.\n");
+    return false;
+  }
+
+  int targetWidth    = scaledSize(width, scale);
+  int targetHeight   = scaledSize(height, scale);
+  int targetBPP      = hasAlpha || compress || isArray ? 32 : 24;
+  int pitchOrLinSize = ((targetWidth * targetBPP / 8 + 3) / 4) * 4;
+  int nMipmaps       = mipmapCount(targetWidth, targetHeight, doMipmaps);
+
+  int flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
+  flags |= doMipmaps ? DDSD_MIPMAPCOUNT : 0;
+  flags |= compress  ? DDSD_LINEARSIZE  : DDSD_PITCH;
+
+  int caps = DDSCAPS_TEXTURE;
+  caps |= doMipmaps ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0;
+  caps |= isCubeMap ? DDSCAPS_COMPLEX : 0;
+
+  int caps2 = isCubeMap ? DDSCAPS2_CUBEMAP : 0;
+  caps2 |= isCubeMap ? DDSCAPS2_CUBEMAP_POSITIVEX | DDSCAPS2_CUBEMAP_NEGITIVEX : 0;
+  caps2 |= isCubeMap ? DDSCAPS2_CUBEMAP_POSITIVEY | DDSCAPS2_CUBEMAP_NEGITIVEY : 0;
+  caps2 |= isCubeMap ? DDSCAPS2_CUBEMAP_POSITIVEZ | DDSCAPS2_CUBEMAP_NEGITIVEZ : 0;
+
+  int pixelFlags = 0;
+  pixelFlags |= hasAlpha ? DDPF_ALPHAPIXELS : 0;
+  pixelFlags |= compress ? DDPF_FOURCC : DDPF_RGB;
+  pixelFlags |= isNormal ? DDPF_NORMAL : 0;
+
+  // Uncompressed pixels stay in FreeImage's BGRA order, RB are only swapped for compression.
+  const char* fourCC = isDX10 ? "DX10" : "\0\0\0\0";
+  int dx10Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+
+  // BC7 blocks are 16 bytes like DXT5 ones.
+  int squishFlags = squishFlagsFor(hasAlpha || isBC7, isPreview);
+
+  if (compress) {
+    pitchOrLinSize = squish::GetStorageRequirements(targetWidth, targetHeight, squishFlags);
+    dx10Format     = isBC7 ? DXGI_FORMAT_BC7_UNORM :
+                     hasAlpha ? DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_BC1_UNORM;
+    fourCC         = isDX10 ? "DX10" : hasAlpha ? "DXT5" : "DXT1";
+  }
+
+  vector<char>* header = &dds->header;
+
+  header->clear();
+  dds->levels.clear();
+  dds->squishFlags = compress && !isBC7 ? squishFlags : 0;
+  dds->isBC7       = isBC7;
+  dds->isPreview   = isPreview;
+  dds->nFaces      = nFaces;
+
+  // Header beginning.
+  appendChars("DDS ", 4, header);
+  appendInt(124, header);
+  appendInt(flags, header);
+  appendInt(targetHeight, header);
+  appendInt(targetWidth, header);
+  appendInt(pitchOrLinSize, header);
+  appendInt(0, header);
+  appendInt(nMipmaps, header);
+
+  // Reserved int[11].
+  for (int i = 0; i < 11; ++i) {
+    appendInt(0, header);
+  }
+
+  // Pixel format.
+  appendInt(32, header);
+  appendInt(pixelFlags, header);
+  appendChars(fourCC, 4, header);
+
+  if (compress) {
+    appendInt(0, header);
+    appendInt(0, header);
+    appendInt(0, header);
+    appendInt(0, header);
+    appendInt(0, header);
+  }
+  else {
+    appendInt(targetBPP, header);
+    appendInt(0x00ff0000, header);
+    appendInt(0x0000ff00, header);
+    appendInt(0x000000ff, header);
+    appendInt(int(0xff000000), header);
+  }
+
+  appendInt(caps, header);
+  appendInt(caps2, header);
+  appendInt(0, header);
+  appendInt(0, header);
+  appendInt(0, header);
+
+  if (isDX10) {
+    appendInt(dx10Format, header);
+    appendInt(D3D10_RESOURCE_DIMENSION_TEXTURE2D, header);
+    appendInt(isCubeMap ? int(D3D10_RESOURCE_MISC_TEXTURECUBE) : 0, header);
+    appendInt(isCubeMap ? 1 : nFaces, header);
+    appendInt(0, header);
+  }
+
+  // Box filter is much cheaper than Catmull-Rom for large levels, good enough for previews.
+  FREE_IMAGE_FILTER mipmapFilter = isPreview ? FILTER_BOX : FILTER_CATMULLROM;
+
+  for (int i = 0; i < nFaces; ++i) {
+    FIBITMAP* face   = createBitmap(faces[i]);
+    BYTE*     pixels = FreeImage_GetBits(face);
+    int       pitch  = int(FreeImage_GetPitch(face));
+
+    if (doFlip) {
+      Kernels::flipVertical(pixels, width, height, pitch);
+    }
+    if (doFlop) {
+      Kernels::flipHorizontal(pixels, width, height, pitch);
+    }
+
+    if (doYYYX) {
+      FreeImage_SetTransparent(face, true);
+      Kernels::swizzleYYYX(pixels, width * height);
+    }
+    else if (doZYZX) {
+      FreeImage_SetTransparent(face, true);
+      Kernels::swizzleZYZX(pixels, width * height);
+    }
+    else if (compress) {
+      Kernels::swapRB(pixels, width * height);
+    }
+
+    if (targetBPP == 24) {
+      face = FreeImage_ConvertTo24Bits(face);
+    }
+
+    int levelWidth  = targetWidth;
+    int levelHeight = targetHeight;
+
+    for (int j = 0; j < nMipmaps; ++j) {
+      FIBITMAP* level = face;
+
+      if (levelWidth != width || levelHeight != height) {
+        level = FreeImage_Rescale(face, levelWidth, levelHeight, mipmapFilter);
+      }
+
+      // Rows are stored without padding, as they are written or passed to the block compressor.
+      const char* pixels  = reinterpret_cast<const char*>(FreeImage_GetBits(level));
+      int         pitch   = int(FreeImage_GetPitch(level));
+      int         rowSize = levelWidth * targetBPP / 8;
+
+      dds->levels.emplace_back();
+
+      DDSData::Level& ddsLevel = dds->levels.back();
+
+      ddsLevel.width  = levelWidth;
+      ddsLevel.height = levelHeight;
+      ddsLevel.data.resize(size_t(rowSize * levelHeight));
+
+      for (int k = 0; k < levelHeight; ++k) {
+        memcpy(&ddsLevel.data[size_t(k * rowSize)], pixels, size_t(rowSize));
+        pixels += pitch;
+      }
+
+      levelWidth  = max(1, levelWidth / 2);
+      levelHeight = max(1, levelHeight / 2);
+
+      if (level != face) {
+        FreeImage_Unload(level);
+      }
+    }
+
+    FreeImage_Unload(face);
+  }
+
+  char summary[64];
+  snprintf(summary, sizeof(summary), "%s  %4dx%-4d  %2d mipmaps%s",
+           isBC7 ? "BC7 " : compress ? fourCC : targetBPP == 32 ? "RGBA" : "RGB ",
+           targetWidth,
+           targetHeight,
+           nMipmaps,
+           isNormal ? "  NORMAL_MAP" : "");
+
+  dds->summary = summary;
+  return true;
+}
+
+void ImageBuilder::compressDDS(DDSData* dds, int nThreads)
+{
+  if (!dds->isBC7 && dds->squishFlags == 0) {
+    return;
+  }
+
+  // Each face gets its own compressor, so output doesn't depend on the number of threads.
+  int                            nFaces        = max(dds->nFaces, 1);
+  int                            speed         = dds->isPreview ? BC7Encoder::FAST : bc7Speed;
+  double                         maxError      = dds->isPreview ? 0.0 : rdoError;
+  size_t                         levelsPerFace = dds->levels.size() / size_t(nFaces);
+  vector<BlockCompressor::Stats> faceStats(static_cast<size_t>(nFaces));
+  vector<size_t>                 originalSizes(static_cast<size_t>(nFaces));
+  vector<size_t>                 rdoSizes(static_cast<size_t>(nFaces));
+  atomic<int>                    nextFace(0);
+
+  nThreads = min(max(nThreads, 1), nFaces);
+
+  // Threads of the BC7 encoder are shared between faces that are compressed in parallel.
+  int encoderThreads = max(bc7Threads / nThreads, 1);
+
+  auto compressFaces = [&]
+  {
+    vector<char> buffer;
+
+    for (int i = nextFace++; i < nFaces; i = nextFace++) {
+      auto begin = dds->levels.begin() + ptrdiff_t(size_t(i) * levelsPerFace);
+      auto end   = begin + ptrdiff_t(levelsPerFace);
+
+      if (dds->isBC7) {
+        BC7Encoder encoder(speed, encoderThreads);
+
+        for (auto level = begin; level != end; ++level) {
+          buffer.resize(size_t(((level->width + 3) / 4) * ((level->height + 3) / 4) * 16));
+          encoder.compress(reinterpret_cast<const uint8_t*>(level->data.data()), level->width,
+                           level->height, &buffer[0]);
+          level->data.swap(buffer);
+        }
+        continue;
+      }
+
+      BlockCompressor compressor(dds->squishFlags, maxError);
+
+      for (auto level = begin; level != end; ++level) {
+        int s3Size = squish::GetStorageRequirements(level->width, level->height, dds->squishFlags);
+
+        buffer.resize(size_t(s3Size));
+        compressor.compress(reinterpret_cast<const uint8_t*>(level->data.data()), level->width,
+                            level->height, &buffer[0]);
+        level->data.swap(buffer);
+      }
+
+      faceStats[size_t(i)] = compressor.getStats();
+
+      if (maxError > 0.0) {
+        compressor.estimateRDOGain(&originalSizes[size_t(i)], &rdoSizes[size_t(i)]);
+      }
+    }
+  };
+
+  if (nThreads == 1) {
+    compressFaces();
+  }
+  else {
+    vector<thread> threads;
+
+    for (int i = 0; i < nThreads; ++i) {
+      threads.emplace_back(compressFaces);
+    }
+    for (thread& t : threads) {
+      t.join();
+    }
+  }
+
+  if (dds->isBC7) {
+    return;
+  }
+
+  BlockCompressor::Stats stats;
+  size_t                 originalSize = 0;
+  size_t                 rdoSize      = 0;
+
+  for (int i = 0; i < nFaces; ++i) {
+    stats.nBlocks += faceStats[size_t(i)].nBlocks;
+    stats.nSolid  += faceStats[size_t(i)].nSolid;
+    stats.nCached += faceStats[size_t(i)].nCached;
+    stats.nRDO    += faceStats[size_t(i)].nRDO;
+    originalSize  += originalSizes[size_t(i)];
+    rdoSize       += rdoSizes[size_t(i)];
+  }
+
+  double nBlocks = double(max(stats.nBlocks, 1L)) / 100.0;
+  char   blockStats[160];
+
+  snprintf(blockStats, sizeof(blockStats), "  %.1f%% solid, %.1f%% reused blocks",
+           double(stats.nSolid) / nBlocks, double(stats.nCached) / nBlocks);
+  dds->summary += blockStats;
+
+  if (maxError > 0.0) {
+    snprintf(blockStats, sizeof(blockStats), "\nRDO  %.1f%% blocks changed  LZ %.1f KiB -> %.1f KiB",
+             double(stats.nRDO) / nBlocks, double(originalSize) / 1024.0,
+             double(rdoSize) / 1024.0);
+    dds->summary += blockStats;
+  }
+}
+
+bool ImageBuilder::writeDDS(const DDSData& dds, const char* destFile)
+{
+  string tempFile = tempFileFor(destFile);
+  FILE*  f        = fopen(tempFile.c_str(), "wb");
+
+  if (f == nullptr) {
+    printf("Failed to open for writing '%s'.\n", destFile);
+    return false;
+  }
+
+  writeChars(dds.header.data(), int(dds.header.size()), f);
+
+  for (const DDSData::Level& level : dds.levels) {
+    writeChars(level.data.data(), int(level.data.size()), f);
+  }
+
+  if (!commitFile(f, tempFile, destFile)) {
+    return false;
+  }
+
+  printf("%s\n%s\n", destFile, dds.summary.c_str());
+  return true;
+}
+
+bool ImageBuilder::createDDS(const ImageData* faces, int nFaces, int options, double scale,
+                             const char* destFile)
+{
+  DDSData dds;
+
+  if (!prepareDDS(faces, nFaces, options, scale, &dds)) {
+    return false;
+  }
+
+  compressDDS(&dds, bc7Threads);
+  return writeDDS(dds, destFile);
 }
 
 void ImageBuilder::init()
 {
+  Kernels::select();
+
   FreeImage_Initialise();
   FreeImage_SetOutputMessage(printError);
 }
@@ -28,6 +28,10 @@
 
 #pragma once
 
+#include <cstddef>
+#include <string>
+#include <vector>
+
 /**
  * %Image pixel data with basic metadata (dimensions and transparency).
  */
@@ -91,6 +95,46 @@ struct ImageData
   bool isNormalMap() const;
 };
 
+/**
+ * Texture dimensions and GPU memory footprint, as read from an image header.
+ */
+struct TextureInfo
+{
+  int    width     = 0;  ///< Width.
+  int    height    = 0;  ///< Height.
+  int    nMipmaps  = 1;  ///< Number of mipmap levels.
+  int    nFaces    = 1;  ///< Number of array elements or cube map faces.
+  char   format[8] = {}; ///< Pixel format name, e.g. "DXT5" or source file extension.
+  size_t memory    = 0;  ///< Texture size in GPU memory including all mipmaps and faces.
+};
+
+/**
+ * DDS file in the middle of conversion.
+ *
+ * It is passed between `ImageBuilder::prepareDDS()`, `compressDDS()` and `writeDDS()`, so that these
+ * stages can run on different threads.
+ */
+struct DDSData
+{
+  /**
+   * One mipmap level of one face.
+   */
+  struct Level
+  {
+    int               width  = 0; ///< Width.
+    int               height = 0; ///< Height.
+    std::vector<char> data;       ///< Pixel rows without padding, compressed blocks once compressed.
+  };
+
+  std::vector<char>  header;              ///< DDS header, with DX10 extension for arrays and BC7.
+  std::vector<Level> levels;              ///< All mipmaps of the first face, then the next face etc.
+  int                squishFlags = 0;     ///< libsquish flags if levels are yet to be compressed.
+  bool               isBC7       = false; ///< Levels are yet to be compressed to BC7.
+  bool               isPreview   = false; ///< Compress with the fastest settings.
+  int                nFaces      = 1;     ///< Number of faces or array slices.
+  std::string        summary;             ///< Format and size description, printed when written.
+};
+
 /**
  * %ImageBuilder class converts generic image formats to DDS (DirectDraw Surface).
  *
@@ -125,6 +169,12 @@ public:
   /// Perform RGB(A) -> BGBR swizzle (for DXT5nm+z normal map compression).
   static const int ZYZX_BIT = 0x80;
 
+  /// Compress to BC7 instead of DXT1/DXT5 (implies `COMPRESSION_BIT`, always uses DX10 header).
+  static const int BC7_BIT = 0x100;
+
+  /// Fast preview quality: box-filtered mipmaps, range fit for DXT, fastest BC7 and no RDO.
+  static const int PREVIEW_BIT = 0x200;
+
 public:
 
   /**
@@ -137,11 +187,87 @@ public:
    */
   static bool printInfo(const char* file);
 
+  /**
+   * Read texture dimensions and compute its GPU memory footprint without decoding pixels.
+   *
+   * For DDS only the header is read. Other images are assumed to be uploaded as uncompressed RGBA
+   * with a full mipmap chain.
+   */
+  static bool readTextureInfo(const char* file, TextureInfo* info);
+
+  /**
+   * True iff the file has a DDS extension.
+   */
+  static bool isDDSFile(const char* file);
+
+  /**
+   * Find mipmap level of a DDS image whose dimensions match a given scale.
+   *
+   * @return level index or -1 if there's no such level.
+   */
+  static int mipmapLevel(const char* file, double scale);
+
+  /**
+   * Downscale a DDS image by removing its top mipmap levels.
+   *
+   * The remaining levels are copied as they are, without decoding and re-encoding pixels. Arrays and
+   * cube maps are supported as well.
+   *
+   * @param file source DDS image.
+   * @param nLevels number of top mipmap levels to drop.
+   * @param destFile output file.
+   */
+  static bool dropMipmaps(const char* file, int nLevels, const char* destFile);
+
+  /**
+   * Read image dimensions from its header without decoding pixels.
+   *
+   * If `hasAlpha` is given, it is set when the image has an alpha channel. Whether the channel is
+   * actually used can only be known after decoding, so this is a conservative guess.
+   */
+  static bool readSize(const char* file, int* width, int* height, bool* hasAlpha = nullptr);
+
+  /**
+   * Size of pixel data `createDDS()` generates for a single face with given options.
+   */
+  static size_t estimateSize(int width, int height, bool hasAlpha, int options, double scale);
+
+  /**
+   * Estimate peak memory usage in bytes for converting an image of given dimensions.
+   *
+   * It accounts for all full-resolution copies that exist at the same time during loading and
+   * `createDDS()`, i.e. FreeImage bitmaps, `ImageData` pixels and rescaled mipmap level.
+   */
+  static size_t estimateMemory(int width, int height, int options, double scale);
+
   /**
    * Load an image.
+   *
+   * Besides formats supported by FreeImage, KSP MBM images and DDS images (uncompressed RGB(A),
+   * DXT1, DXT3 and DXT5, with or without DX10 header) are supported. Only the base mipmap level of
+   * the first DDS face is loaded.
    */
   static ImageData loadImage(const char* file);
 
+  /**
+   * Read the whole file into memory, the I/O part of `loadImage()`.
+   */
+  static bool readFile(const char* file, std::vector<char>* data);
+
+  /**
+   * Decode image file contents, the CPU part of `loadImage()`.
+   *
+   * @param file file name, used to determine the format by extension.
+   * @param data file contents.
+   */
+  static ImageData decodeImage(const char* file, const std::vector<char>& data);
+
+  /**
+   * Adjust conversion options for a loaded image: MBM and DDS normal maps get normal map flag and
+   * are not swizzled again.
+   */
+  static int optionsFor(const ImageData& image, int options);
+
   /**
    * Generate a DDS form a given image and optionally compress it and create mipmaps.
    *
@@ -150,8 +276,8 @@ public:
    * be given in the following order: +x, -x, +y, -y, +z, -z.
    *
    * @note
-   * The highest possible quality settings are used for compression and mipmap scaling, so this
-   * might take a long time for a large image.
+   * The highest possible quality settings are used for compression and mipmap scaling unless
+   * `PREVIEW_BIT` is set, so this might take a long time for a large image.
    *
    * @param faces array of pointers to pixels of input images.
    * @param nFaces number of input images.
@@ -161,6 +287,42 @@ public:
   static bool createDDS(const ImageData* faces, int nFaces, int options, double scale,
                         const char* destFile);
 
+  /**
+   * First stage of `createDDS()`: apply transformations, generate mipmaps and the header.
+   */
+  static bool prepareDDS(const ImageData* faces, int nFaces, int options, double scale,
+                         DDSData* dds);
+
+  /**
+   * Second stage of `createDDS()`: compress all levels if compression is enabled.
+   *
+   * Faces (array slices) are compressed independently and divided between `nThreads` threads.
+   */
+  static void compressDDS(DDSData* dds, int nThreads = 1);
+
+  /**
+   * Last stage of `createDDS()`: atomically write the file and print its description.
+   */
+  static bool writeDDS(const DDSData& dds, const char* destFile);
+
+  /**
+   * Enable rate-distortion optimisation of DXT blocks for all subsequent `createDDS()` calls.
+   *
+   * Blocks are allowed to repeat bit patterns of earlier blocks as long as RMS error grows by at
+   * most `maxError` 8-bit levels. This makes files compress much better with zip or 7z, at the cost
+   * of slightly lower quality. 0 disables it (default).
+   */
+  static void setRDOError(double maxError);
+
+  /**
+   * Set BC7 encoder speed level (see `BC7Encoder`) and number of threads it uses per image for all
+   * subsequent `createDDS()` calls. Defaults are `BC7Encoder::NORMAL` and a single thread.
+   *
+   * `createDDS()` also uses this many threads to compress faces of arrays and cube maps in
+   * parallel, in any format.
+   */
+  static void setBC7Options(int speed, int nThreads);
+
   /**
    * Initialise underlaying FreeImage library.
    *
@@ -0,0 +1,359 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file ImageDecoder.cc
+ *
+ * TGA layout follows the Truevision TGA 2.0 specification. Only uncompressed and RLE true-colour
+ * (24 and 32 bpp) and greyscale (8 bpp) images are decoded.
+ */
+
+#include "ImageDecoder.hh"
+
+#include "ImageBuilder.hh"
+#include "Kernels.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_LIBPNG
+# include <csetjmp>
+# include <png.h>
+#endif
+
+using namespace std;
+
+static const int TGA_HEADER_SIZE   = 18;
+static const int TGA_TRUE_COLOUR   = 2;
+static const int TGA_GREYSCALE     = 3;
+static const int TGA_RLE_BIT       = 8;
+static const int TGA_RIGHT_TO_LEFT = 0x10;
+static const int TGA_TOP_DOWN      = 0x20;
+
+static inline int getShort(const char* data)
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  return bytes[0] | bytes[1] << 8;
+}
+
+static bool hasExtension(const char* file, const char* extension)
+{
+  const char* dot = strrchr(file, '.');
+  if (dot == nullptr || strlen(dot + 1) != strlen(extension)) {
+    return false;
+  }
+
+  for (int i = 0; extension[i] != '\0'; ++i) {
+    if (tolower(static_cast<unsigned char>(dot[1 + i])) != extension[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef HAVE_LIBPNG
+
+/**
+ * Source of libpng reads, also used to report errors.
+ */
+struct PNGSource
+{
+  const char*         file;
+  const vector<char>* data;
+  size_t              pos;
+};
+
+static void readPNGData(png_structp png, png_bytep dest, png_size_t size)
+{
+  PNGSource* source = static_cast<PNGSource*>(png_get_io_ptr(png));
+
+  if (source->data->size() - source->pos < size) {
+    png_error(png, "Unexpected end of file");
+  }
+
+  memcpy(dest, &(*source->data)[source->pos], size);
+  source->pos += size;
+}
+
+static void printPNGError(png_structp png, png_const_charp message)
+{
+  PNGSource* source = static_cast<PNGSource*>(png_get_error_ptr(png));
+
+  printf("libpng(%s): %s\n", source->file, message);
+  longjmp(png_jmpbuf(png), 1);
+}
+
+static void ignorePNGWarning(png_structp, png_const_charp)
+{}
+
+// Signature and IHDR chunk, which starts with width and height.
+static const int PNG_HEADER_SIZE = 24;
+
+static inline unsigned getBigInt(const char* data)
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  return unsigned(bytes[0]) << 24 | unsigned(bytes[1]) << 16 | unsigned(bytes[2]) << 8 | bytes[3];
+}
+
+// Images larger than `MAX_DIMENSION` are left to FreeImage. Truncated headers are decoded here, so
+// that libpng reports the error.
+static bool isSupportedPNG(const vector<char>& data)
+{
+  if (data.size() < 8 || png_sig_cmp(reinterpret_cast<png_const_bytep>(data.data()), 0, 8) != 0) {
+    return false;
+  }
+
+  return data.size() < size_t(PNG_HEADER_SIZE) ||
+         (getBigInt(&data[16]) <= unsigned(ImageDecoder::MAX_DIMENSION) &&
+          getBigInt(&data[20]) <= unsigned(ImageDecoder::MAX_DIMENSION));
+}
+
+static void decodePNG(const char* file, const vector<char>& data, ImageData* image)
+{
+  PNGSource   source = { file, &data, 8 };
+  png_structp png    = png_create_read_struct(PNG_LIBPNG_VER_STRING, &source, printPNGError,
+                                              ignorePNGWarning);
+  png_infop   info   = png == nullptr ? nullptr : png_create_info_struct(png);
+
+  if (info == nullptr) {
+    printf("Failed to initialise libpng for '%s'.\n", file);
+    png_destroy_read_struct(&png, nullptr, nullptr);
+    return;
+  }
+
+  // Errors jump back here, after a message has been printed.
+  if (setjmp(png_jmpbuf(png))) {
+    *image = ImageData();
+    png_destroy_read_struct(&png, &info, nullptr);
+    return;
+  }
+
+  png_set_read_fn(png, &source, readPNGData);
+  png_set_sig_bytes(png, 8);
+  png_set_user_limits(png, ImageDecoder::MAX_DIMENSION, ImageDecoder::MAX_DIMENSION);
+  png_read_info(png, info);
+
+  int width      = int(png_get_image_width(png, info));
+  int height     = int(png_get_image_height(png, info));
+  int colourType = png_get_color_type(png, info);
+
+  // Everything is expanded to 8-bit RGBA.
+  png_set_expand(png);
+  png_set_strip_16(png);
+  png_set_gray_to_rgb(png);
+
+  if (!(colourType & PNG_COLOR_MASK_ALPHA) && !png_get_valid(png, info, PNG_INFO_tRNS)) {
+    png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+  }
+
+  int nPasses = png_set_interlace_handling(png);
+
+  png_read_update_info(png, info);
+
+  if (png_get_rowbytes(png, info) != size_t(width) * 4) {
+    png_error(png, "Unsupported pixel format");
+  }
+
+  *image = ImageData(width, height);
+
+  // Interlaced images are refined in place, alpha is only final after the last pass.
+  bool hasAlpha = false;
+
+  for (int pass = 0; pass < nPasses; ++pass) {
+    for (int i = 0; i < height; ++i) {
+      png_bytep row = reinterpret_cast<png_bytep>(image->pixels + size_t(i * width) * 4);
+
+      png_read_row(png, row, nullptr);
+
+      if (pass == nPasses - 1 && !hasAlpha) {
+        hasAlpha = Kernels::hasAlpha(row, width);
+      }
+    }
+  }
+
+  image->flags |= hasAlpha ? ImageData::ALPHA_BIT : 0;
+
+  png_destroy_read_struct(&png, &info, nullptr);
+}
+
+#endif
+
+// Convert a run of TGA pixels (grey, BGR or BGRA) to RGBA.
+static void convertTGAPixels(const unsigned char* src, int pixelSize, int nPixels,
+                             unsigned char* dest)
+{
+  switch (pixelSize) {
+    case 1: {
+      for (int i = 0; i < nPixels; ++i) {
+        dest[i * 4 + 0] = src[i];
+        dest[i * 4 + 1] = src[i];
+        dest[i * 4 + 2] = src[i];
+        dest[i * 4 + 3] = 255;
+      }
+      break;
+    }
+    case 3: {
+      for (int i = 0; i < nPixels; ++i) {
+        dest[i * 4 + 0] = src[i * 3 + 2];
+        dest[i * 4 + 1] = src[i * 3 + 1];
+        dest[i * 4 + 2] = src[i * 3 + 0];
+        dest[i * 4 + 3] = 255;
+      }
+      break;
+    }
+    default: {
+      Kernels::copySwapRB(dest, src, nPixels);
+      break;
+    }
+  }
+}
+
+static bool isSupportedTGA(const char* file, const vector<char>& data)
+{
+  if (!hasExtension(file, "tga") || data.size() < size_t(TGA_HEADER_SIZE)) {
+    return false;
+  }
+
+  int colourMapType = data[1];
+  int imageType     = data[2] & ~TGA_RLE_BIT;
+  int width         = getShort(&data[12]);
+  int height        = getShort(&data[14]);
+  int bpp           = data[16];
+
+  // Images larger than `MAX_DIMENSION` are left to FreeImage.
+  return (colourMapType == 0 || colourMapType == 1) &&
+         width <= ImageDecoder::MAX_DIMENSION && height <= ImageDecoder::MAX_DIMENSION &&
+         ((imageType == TGA_TRUE_COLOUR && (bpp == 24 || bpp == 32)) ||
+          (imageType == TGA_GREYSCALE && bpp == 8));
+}
+
+static void decodeTGA(const char* file, const vector<char>& data, ImageData* image)
+{
+  int  idLength      = static_cast<unsigned char>(data[0]);
+  int  colourMapType = data[1];
+  int  colourMapSize = getShort(&data[5]) * ((static_cast<unsigned char>(data[7]) + 7) / 8);
+  bool isRLE         = data[2] & TGA_RLE_BIT;
+  int  width         = getShort(&data[12]);
+  int  height        = getShort(&data[14]);
+  int  pixelSize     = data[16] / 8;
+  int  descriptor    = data[17];
+
+  if (width == 0 || height == 0) {
+    printf("Invalid TGA dimensions %dx%d in '%s'.\n", width, height, file);
+    return;
+  }
+
+  const unsigned char* begin  = reinterpret_cast<const unsigned char*>(data.data());
+  const unsigned char* end    = begin + data.size();
+  size_t               offset = size_t(TGA_HEADER_SIZE + idLength) +
+                                size_t(colourMapType == 1 ? colourMapSize : 0);
+  const unsigned char* src    = begin + min(offset, data.size());
+
+  *image = ImageData(width, height);
+
+  // RLE packets may continue from one row to the next.
+  const unsigned char* runPixel = nullptr;
+  int                  nPacket  = 0;
+  bool                 hasAlpha = false;
+  bool                 isValid  = offset <= data.size();
+
+  for (int i = 0; i < height && isValid; ++i) {
+    int            y   = descriptor & TGA_TOP_DOWN ? i : height - 1 - i;
+    unsigned char* row = reinterpret_cast<unsigned char*>(image->pixels) + size_t(y * width) * 4;
+
+    if (!isRLE) {
+      isValid = end - src >= ptrdiff_t(width) * pixelSize;
+
+      if (isValid) {
+        convertTGAPixels(src, pixelSize, width, row);
+        src += width * pixelSize;
+      }
+    }
+    else {
+      for (int x = 0; x < width && isValid;) {
+        if (nPacket == 0) {
+          isValid = end - src >= 1 + pixelSize;
+
+          if (!isValid) {
+            break;
+          }
+
+          runPixel = *src & 0x80 ? src + 1 : nullptr;
+          nPacket  = (*src & 0x7f) + 1;
+          src     += runPixel != nullptr ? 1 + pixelSize : 1;
+        }
+
+        int n = min(nPacket, width - x);
+
+        if (runPixel != nullptr) {
+          for (int j = 0; j < n; ++j) {
+            convertTGAPixels(runPixel, pixelSize, 1, row + (x + j) * 4);
+          }
+        }
+        else {
+          isValid = end - src >= ptrdiff_t(n) * pixelSize;
+
+          if (isValid) {
+            convertTGAPixels(src, pixelSize, n, row + x * 4);
+            src += n * pixelSize;
+          }
+        }
+
+        x       += n;
+        nPacket -= n;
+      }
+    }
+
+    if (descriptor & TGA_RIGHT_TO_LEFT) {
+      Kernels::flipHorizontal(row, width, 1, width * 4);
+    }
+    if (pixelSize == 4 && !hasAlpha) {
+      hasAlpha = Kernels::hasAlpha(row, width);
+    }
+  }
+
+  if (!isValid) {
+    printf("Truncated TGA file '%s'.\n", file);
+    *image = ImageData();
+    return;
+  }
+
+  image->flags |= hasAlpha ? ImageData::ALPHA_BIT : 0;
+}
+
+bool ImageDecoder::decode(const char* file, const vector<char>& data, ImageData* image)
+{
+#ifdef HAVE_LIBPNG
+  if (isSupportedPNG(data)) {
+    decodePNG(file, data, image);
+    return true;
+  }
+#endif
+
+  if (isSupportedTGA(file, data)) {
+    decodeTGA(file, data, image);
+    return true;
+  }
+  return false;
+}
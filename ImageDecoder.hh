@@ -0,0 +1,66 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file ImageDecoder.hh
+ *
+ * `ImageDecoder` class.
+ */
+
+#pragma once
+
+#include <vector>
+
+struct ImageData;
+
+/**
+ * Direct decoders for the most common source formats, PNG and TGA.
+ *
+ * Rows are decoded straight into `ImageData` pixels, already top-down and in RGBA order, and alpha
+ * is checked row by row as it is decoded. This avoids the intermediate FreeImage bitmap, its 32-bit
+ * conversion, flip and the final copy with channel swap. Anything these decoders don't handle
+ * (other formats, colour-mapped or 16-bit TGA, PNG without libpng, images larger than
+ * `MAX_DIMENSION`) is left to FreeImage.
+ */
+class ImageDecoder
+{
+public:
+
+  /// Largest width or height decoded here, larger images are left to FreeImage.
+  static const int MAX_DIMENSION = 16384;
+
+public:
+
+  /**
+   * Forbid instances.
+   */
+  ImageDecoder() = delete;
+
+  /**
+   * Decode a PNG or TGA image from file contents.
+   *
+   * @return false iff the format is not supported here and FreeImage should be used instead. On
+   *         decoding errors true is returned and `image` is left empty.
+   */
+  static bool decode(const char* file, const std::vector<char>& data, ImageData* image);
+
+};
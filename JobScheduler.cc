@@ -0,0 +1,145 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file JobScheduler.cc
+ */
+
+#include "JobScheduler.hh"
+
+#include <unistd.h>
+
+using namespace std;
+
+JobScheduler::JobScheduler(size_t memoryBudget) :
+  budget(memoryBudget == 0 ? size_t(-1) : memoryBudget), nFailed(0)
+{}
+
+void JobScheduler::add(const Job& job)
+{
+  {
+    lock_guard<std::mutex> lock(mutex);
+    pending.insert(make_pair(job.memory, job));
+  }
+  cond.notify_all();
+}
+
+void JobScheduler::close()
+{
+  {
+    lock_guard<std::mutex> lock(mutex);
+    isClosed = true;
+  }
+  cond.notify_all();
+}
+
+bool JobScheduler::acquire(Job* job)
+{
+  unique_lock<std::mutex> lock(mutex);
+
+  while (true) {
+    if (pending.empty()) {
+      if (isClosed) {
+        return false;
+      }
+    }
+    else {
+      // Pending jobs are sorted by descending memory, so this is the largest one that fits.
+      auto i = pending.lower_bound(budget - used);
+
+      // A job larger than the whole budget drains the scheduler: nothing else is admitted until it
+      // can run alone, otherwise a steady stream of small jobs (watch mode) would starve it.
+      if (pending.begin()->first > budget) {
+        i = nRunning == 0 ? pending.begin() : pending.end();
+      }
+      if (i != pending.end()) {
+        *job = i->second;
+        pending.erase(i);
+
+        used     += min(job->memory, budget - used);
+        nRunning += 1;
+        return true;
+      }
+    }
+
+    cond.wait(lock);
+  }
+}
+
+void JobScheduler::release(const Job& job)
+{
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    used     -= min(job.memory, used);
+    nRunning -= 1;
+  }
+  cond.notify_all();
+}
+
+void JobScheduler::start(int nThreads, const function<bool(const Job&)>& process)
+{
+  for (int i = 0; i < max(nThreads, 1); ++i) {
+    threads.emplace_back([this, process]
+    {
+      Job job;
+
+      while (acquire(&job)) {
+        if (!process(job)) {
+          ++nFailed;
+        }
+        release(job);
+      }
+    });
+  }
+}
+
+int JobScheduler::wait()
+{
+  close();
+
+  for (thread& t : threads) {
+    t.join();
+  }
+  threads.clear();
+
+  return nFailed;
+}
+
+int JobScheduler::run(int nThreads, const function<bool(const Job&)>& process)
+{
+  start(nThreads, process);
+  return wait();
+}
+
+size_t JobScheduler::defaultBudget()
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  long nPages   = sysconf(_SC_PHYS_PAGES);
+  long pageSize = sysconf(_SC_PAGESIZE);
+
+  if (nPages > 0 && pageSize > 0) {
+    return size_t(nPages) / 2 * size_t(pageSize);
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file JobScheduler.hh
+ *
+ * `JobScheduler` class.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Memory-aware queue of conversion jobs.
+ *
+ * Each job carries an estimate of its peak memory usage and jobs are only admitted while the sum of
+ * estimates of running jobs stays under the memory budget. The largest pending job that fits is
+ * always taken first, so smaller jobs fill the gaps left between the big ones. A job larger than the
+ * whole budget is only admitted when nothing else is running and no other jobs are admitted while
+ * it waits for that.
+ */
+class JobScheduler
+{
+public:
+
+  /**
+   * Conversion job.
+   */
+  struct Job
+  {
+    std::string file;          ///< Source image.
+    std::string destFile;      ///< Output file.
+    int         options = 0;   ///< `ImageBuilder` options.
+    double      scale   = 1.0; ///< Scale.
+    size_t      memory  = 0;   ///< Estimated peak memory usage in bytes.
+  };
+
+private:
+
+  std::mutex                                           mutex;
+  std::condition_variable                              cond;
+  std::multimap<size_t, Job, std::greater<size_t>>     pending;
+  size_t                                               budget;
+  size_t                                               used     = 0;
+  int                                                  nRunning = 0;
+  bool                                                 isClosed = false;
+  std::vector<std::thread>                             threads;
+  std::atomic<int>                                     nFailed;
+
+public:
+
+  /**
+   * Create a scheduler with a given memory budget in bytes (0 for unlimited).
+   */
+  explicit JobScheduler(size_t memoryBudget);
+
+  /**
+   * Queue a job.
+   */
+  void add(const Job& job);
+
+  /**
+   * Mark that no more jobs will be added, `acquire()` fails once all pending jobs are taken.
+   */
+  void close();
+
+  /**
+   * Wait until a pending job fits into the memory budget and take it.
+   *
+   * @return false iff the scheduler is closed and no jobs are pending.
+   */
+  bool acquire(Job* job);
+
+  /**
+   * Return memory of a finished job back to the budget.
+   */
+  void release(const Job& job);
+
+  /**
+   * Start worker threads that process jobs as they are added until the scheduler is closed.
+   */
+  void start(int nThreads, const std::function<bool(const Job&)>& process);
+
+  /**
+   * Close the scheduler and wait until worker threads finish all queued jobs.
+   *
+   * @return number of failed jobs.
+   */
+  int wait();
+
+  /**
+   * Close the scheduler and process all queued jobs on a given number of threads.
+   *
+   * @return number of failed jobs.
+   */
+  int run(int nThreads, const std::function<bool(const Job&)>& process);
+
+  /**
+   * Default memory budget, half of physical memory or 0 (unlimited) if it cannot be determined.
+   */
+  static size_t defaultBudget();
+
+};
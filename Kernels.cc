@@ -0,0 +1,293 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Kernels.cc
+ *
+ * Kernel bodies are written once as always-inline functions and instantiated inside wrappers with
+ * different `target` attributes, so the compiler vectorises each copy for its instruction set.
+ * Loops avoid early exits inside inner loops, otherwise they wouldn't get vectorised.
+ */
+
+#include "Kernels.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define KERNEL static inline __attribute__((always_inline))
+
+#if defined(__i386__) || defined(__x86_64__)
+# define HAS_X86_VARIANTS
+#endif
+
+// Number of pixels processed between early-exit checks.
+static const int CHUNK_SIZE = 256;
+
+// Limits of squared length of (2 * RGB - 255) vector for a normal map pixel and minimal alpha, see
+// `ImageData::isNormalMap()`.
+static const int NORMAL_MIN_LENGTH_SQ = 52020;
+static const int NORMAL_MAX_LENGTH_SQ = 468180;
+static const int NORMAL_MIN_ALPHA     = 230;
+
+KERNEL bool hasAlphaBody(const unsigned char* pixels, int nPixels)
+{
+  for (int i = 0; i < nPixels; i += CHUNK_SIZE) {
+    int           end   = nPixels - i < CHUNK_SIZE ? nPixels : i + CHUNK_SIZE;
+    unsigned char alpha = 255;
+
+    for (int j = i; j < end; ++j) {
+      alpha &= pixels[j * 4 + 3];
+    }
+    if (alpha != 255) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Kept out of line so that the final floating-point test is the same code for all variants.
+static __attribute__((noinline)) bool isNormalAverage(const int64_t* sum, int nPixels)
+{
+  // Average colour must be close to #8080ff, i.e. (0, 0, 0.5) after being shifted by -0.5.
+  double n          = 510.0 * nPixels;
+  double average[3] = { double(sum[0]) / n, double(sum[1]) / n, double(sum[2]) / n - 0.5 };
+
+  return average[0]*average[0] + average[1]*average[1] + average[2]*average[2] < 0.1;
+}
+
+KERNEL bool isNormalMapBody(const unsigned char* pixels, int nPixels)
+{
+  int64_t sum[3] = { 0, 0, 0 };
+
+  for (int i = 0; i < nPixels; i += CHUNK_SIZE) {
+    int     end         = nPixels - i < CHUNK_SIZE ? nPixels : i + CHUNK_SIZE;
+    int     nInvalid    = 0;
+    int32_t chunkSum[3] = { 0, 0, 0 };
+
+    for (int j = i; j < end; ++j) {
+      int x = 2 * pixels[j * 4 + 0] - 255;
+      int y = 2 * pixels[j * 4 + 1] - 255;
+      int z = 2 * pixels[j * 4 + 2] - 255;
+      int a = pixels[j * 4 + 3];
+
+      int lengthSq = x*x + y*y + z*z;
+
+      nInvalid += lengthSq < NORMAL_MIN_LENGTH_SQ || lengthSq > NORMAL_MAX_LENGTH_SQ ||
+                  a < NORMAL_MIN_ALPHA;
+
+      chunkSum[0] += x;
+      chunkSum[1] += y;
+      chunkSum[2] += z;
+    }
+
+    if (nInvalid != 0) {
+      return false;
+    }
+
+    sum[0] += chunkSum[0];
+    sum[1] += chunkSum[1];
+    sum[2] += chunkSum[2];
+  }
+
+  return isNormalAverage(sum, nPixels);
+}
+
+KERNEL void swapRBBody(unsigned char* pixels, int nPixels)
+{
+  for (int i = 0; i < nPixels; ++i) {
+    unsigned char temp = pixels[i * 4 + 0];
+
+    pixels[i * 4 + 0] = pixels[i * 4 + 2];
+    pixels[i * 4 + 2] = temp;
+  }
+}
+
+KERNEL void copySwapRBBody(unsigned char* __restrict__ dest,
+                           const unsigned char* __restrict__ src, int nPixels)
+{
+  for (int i = 0; i < nPixels; ++i) {
+    dest[i * 4 + 0] = src[i * 4 + 2];
+    dest[i * 4 + 1] = src[i * 4 + 1];
+    dest[i * 4 + 2] = src[i * 4 + 0];
+    dest[i * 4 + 3] = src[i * 4 + 3];
+  }
+}
+
+KERNEL void swizzleYYYXBody(unsigned char* pixels, int nPixels)
+{
+  for (int i = 0; i < nPixels; ++i) {
+    pixels[i * 4 + 3] = pixels[i * 4 + 2];
+    pixels[i * 4 + 0] = pixels[i * 4 + 1];
+    pixels[i * 4 + 2] = pixels[i * 4 + 1];
+  }
+}
+
+KERNEL void swizzleZYZXBody(unsigned char* pixels, int nPixels)
+{
+  for (int i = 0; i < nPixels; ++i) {
+    pixels[i * 4 + 3] = pixels[i * 4 + 2];
+    pixels[i * 4 + 2] = pixels[i * 4 + 0];
+  }
+}
+
+KERNEL void flipHorizontalBody(unsigned char* pixels, int width, int height, int pitch)
+{
+  for (int i = 0; i < height; ++i) {
+    uint32_t* row = reinterpret_cast<uint32_t*>(pixels + i * pitch);
+
+    for (int j = 0; j < width / 2; ++j) {
+      uint32_t temp = row[j];
+
+      row[j]             = row[width - 1 - j];
+      row[width - 1 - j] = temp;
+    }
+  }
+}
+
+KERNEL void flipVerticalBody(unsigned char* pixels, int width, int height, int pitch)
+{
+  int rowSize = width * 4;
+
+  for (int i = 0; i < height / 2; ++i) {
+    unsigned char* top    = pixels + i * pitch;
+    unsigned char* bottom = pixels + (height - 1 - i) * pitch;
+
+    for (int j = 0; j < rowSize; ++j) {
+      unsigned char temp = top[j];
+
+      top[j]    = bottom[j];
+      bottom[j] = temp;
+    }
+  }
+}
+
+#define DEFINE_VARIANT(NS, TARGET) \
+  namespace NS \
+  { \
+    TARGET static bool hasAlpha(const unsigned char* pixels, int nPixels) \
+    { \
+      return hasAlphaBody(pixels, nPixels); \
+    } \
+    TARGET static bool isNormalMap(const unsigned char* pixels, int nPixels) \
+    { \
+      return isNormalMapBody(pixels, nPixels); \
+    } \
+    TARGET static void swapRB(unsigned char* pixels, int nPixels) \
+    { \
+      swapRBBody(pixels, nPixels); \
+    } \
+    TARGET static void copySwapRB(unsigned char* dest, const unsigned char* src, int nPixels) \
+    { \
+      copySwapRBBody(dest, src, nPixels); \
+    } \
+    TARGET static void swizzleYYYX(unsigned char* pixels, int nPixels) \
+    { \
+      swizzleYYYXBody(pixels, nPixels); \
+    } \
+    TARGET static void swizzleZYZX(unsigned char* pixels, int nPixels) \
+    { \
+      swizzleZYZXBody(pixels, nPixels); \
+    } \
+    TARGET static void flipHorizontal(unsigned char* pixels, int width, int height, int pitch) \
+    { \
+      flipHorizontalBody(pixels, width, height, pitch); \
+    } \
+    TARGET static void flipVertical(unsigned char* pixels, int width, int height, int pitch) \
+    { \
+      flipVerticalBody(pixels, width, height, pitch); \
+    } \
+  }
+
+DEFINE_VARIANT(baseline, )
+
+#ifdef HAS_X86_VARIANTS
+DEFINE_VARIANT(avx2, __attribute__((target("avx2"))))
+DEFINE_VARIANT(avx512, __attribute__((target("avx512f,avx512bw"))))
+#endif
+
+#define SET_VARIANT(NS) \
+  hasAlpha       = NS::hasAlpha; \
+  isNormalMap    = NS::isNormalMap; \
+  swapRB         = NS::swapRB; \
+  copySwapRB     = NS::copySwapRB; \
+  swizzleYYYX    = NS::swizzleYYYX; \
+  swizzleZYZX    = NS::swizzleZYZX; \
+  flipHorizontal = NS::flipHorizontal; \
+  flipVertical   = NS::flipVertical; \
+  selectedName   = #NS
+
+static const char* selectedName = "baseline";
+
+bool (* Kernels::hasAlpha)(const unsigned char*, int)                 = baseline::hasAlpha;
+bool (* Kernels::isNormalMap)(const unsigned char*, int)              = baseline::isNormalMap;
+void (* Kernels::swapRB)(unsigned char*, int)                         = baseline::swapRB;
+void (* Kernels::copySwapRB)(unsigned char*, const unsigned char*, int) = baseline::copySwapRB;
+void (* Kernels::swizzleYYYX)(unsigned char*, int)                    = baseline::swizzleYYYX;
+void (* Kernels::swizzleZYZX)(unsigned char*, int)                    = baseline::swizzleZYZX;
+void (* Kernels::flipHorizontal)(unsigned char*, int, int, int)       = baseline::flipHorizontal;
+void (* Kernels::flipVertical)(unsigned char*, int, int, int)         = baseline::flipVertical;
+
+bool Kernels::select(const char* isa)
+{
+  if (isa == nullptr) {
+    isa = getenv("IMG2DDS_ISA");
+  }
+
+#ifdef HAS_X86_VARIANTS
+  __builtin_cpu_init();
+
+  bool hasAVX2   = __builtin_cpu_supports("avx2");
+  bool hasAVX512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+
+  if (isa == nullptr) {
+    isa = hasAVX512 ? "avx512" : hasAVX2 ? "avx2" : "baseline";
+  }
+
+  if (strcmp(isa, "avx512") == 0 && hasAVX512) {
+    SET_VARIANT(avx512);
+    return true;
+  }
+  else if (strcmp(isa, "avx2") == 0 && hasAVX2) {
+    SET_VARIANT(avx2);
+    return true;
+  }
+#else
+  if (isa == nullptr) {
+    isa = "baseline";
+  }
+#endif
+
+  SET_VARIANT(baseline);
+
+  if (strcmp(isa, "baseline") != 0) {
+    printf("Kernel variant '%s' is unknown or not supported by CPU, using baseline.\n", isa);
+    return false;
+  }
+  return true;
+}
+
+const char* Kernels::selected()
+{
+  return selectedName;
+}
@@ -0,0 +1,90 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Kernels.hh
+ *
+ * `Kernels` class.
+ */
+
+#pragma once
+
+/**
+ * Pixel processing kernels with runtime CPU dispatch.
+ *
+ * Each kernel is compiled for several instruction sets and the best variant the CPU supports is
+ * chosen by `select()`, so binaries built for old CPUs still use AVX2/AVX-512 where available. All
+ * kernels use integer arithmetic only, hence results are byte-identical across variants.
+ *
+ * Pixels are 32-bit, four 8-bit channels with alpha last (either RGBA or BGRA).
+ */
+class Kernels
+{
+public:
+
+  /// True iff any pixel has alpha different from 255.
+  static bool (* hasAlpha)(const unsigned char* pixels, int nPixels);
+
+  /// Normal map heuristic, see `ImageData::isNormalMap()`.
+  static bool (* isNormalMap)(const unsigned char* pixels, int nPixels);
+
+  /// Swap the first and the third channel, RGBA <-> BGRA.
+  static void (* swapRB)(unsigned char* pixels, int nPixels);
+
+  /// Copy pixels while swapping the first and the third channel.
+  static void (* copySwapRB)(unsigned char* dest, const unsigned char* src, int nPixels);
+
+  /// RGB(A) -> GGGR swizzle of BGRA pixels (for DXT5nm).
+  static void (* swizzleYYYX)(unsigned char* pixels, int nPixels);
+
+  /// RGB(A) -> BGBR swizzle of BGRA pixels (for DXT5nm+z).
+  static void (* swizzleZYZX)(unsigned char* pixels, int nPixels);
+
+  /// Mirror rows.
+  static void (* flipHorizontal)(unsigned char* pixels, int width, int height, int pitch);
+
+  /// Mirror columns.
+  static void (* flipVertical)(unsigned char* pixels, int width, int height, int pitch);
+
+public:
+
+  /**
+   * Forbid instances.
+   */
+  Kernels() = delete;
+
+  /**
+   * Select kernel variants.
+   *
+   * If `isa` is null, `IMG2DDS_ISA` environment variable is checked and if that is not set either
+   * the best variant the CPU supports is chosen. Valid names are "baseline", "avx2" and "avx512".
+   *
+   * @return false iff the requested variant is unknown or not supported by the CPU.
+   */
+  static bool select(const char* isa = nullptr);
+
+  /**
+   * Name of selected variant.
+   */
+  static const char* selected();
+
+};
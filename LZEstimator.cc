@@ -0,0 +1,125 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file LZEstimator.cc
+ */
+
+#include "LZEstimator.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+static const int HASH_BITS = 15;
+
+static inline int hashAt(const uint8_t* data)
+{
+  uint32_t value = uint32_t(data[0]) << 16 | uint32_t(data[1]) << 8 | data[2];
+  return int((value * 2654435761u) >> (32 - HASH_BITS));
+}
+
+// Number of extra bits Deflate uses for a match distance.
+static inline int distanceBits(int distance)
+{
+  int bits = 0;
+
+  for (int d = distance - 1; d >= 4; d >>= 1) {
+    ++bits;
+  }
+  return bits;
+}
+
+size_t LZEstimator::estimate(const uint8_t* data, size_t size)
+{
+  vector<int> head(1 << HASH_BITS, -1);
+  vector<int> prev(WINDOW_SIZE, -1);
+  long        literals[256] = {};
+  long        nLiterals     = 0;
+  double      matchBits     = 0.0;
+  int         length        = int(size);
+
+  auto insert = [&](int pos)
+  {
+    if (pos + MIN_MATCH <= length) {
+      int hash = hashAt(data + pos);
+
+      prev[size_t(pos % WINDOW_SIZE)] = head[size_t(hash)];
+      head[size_t(hash)]              = pos;
+    }
+  };
+
+  for (int pos = 0; pos < length;) {
+    int bestLength   = 0;
+    int bestDistance = 0;
+
+    if (pos + MIN_MATCH <= length) {
+      int candidate = head[size_t(hashAt(data + pos))];
+      int maxLength = min(MAX_MATCH, length - pos);
+
+      for (int i = 0; i < MAX_CHAIN && candidate >= 0 && pos - candidate <= WINDOW_SIZE; ++i) {
+        int matchLength = 0;
+
+        while (matchLength < maxLength && data[candidate + matchLength] == data[pos + matchLength]) {
+          ++matchLength;
+        }
+        if (matchLength > bestLength) {
+          bestLength   = matchLength;
+          bestDistance = pos - candidate;
+        }
+
+        int next = prev[size_t(candidate % WINDOW_SIZE)];
+        candidate = next < candidate ? next : -1;
+      }
+    }
+
+    if (bestLength >= MIN_MATCH) {
+      // Length code (~7 bits + extra bits for longer matches) and distance code (5 bits + extra).
+      matchBits += 7.0 + (bestLength > 10 ? std::log2(double(bestLength - 3)) - 2.0 : 0.0);
+      matchBits += 5.0 + distanceBits(bestDistance);
+
+      for (int i = 0; i < bestLength; ++i) {
+        insert(pos + i);
+      }
+      pos += bestLength;
+    }
+    else {
+      ++literals[data[pos]];
+      ++nLiterals;
+
+      insert(pos);
+      ++pos;
+    }
+  }
+
+  double literalBits = 0.0;
+
+  for (long count : literals) {
+    if (count != 0) {
+      literalBits -= double(count) * std::log2(double(count) / double(nLiterals));
+    }
+  }
+
+  return size_t(std::ceil((literalBits + matchBits) / 8.0));
+}
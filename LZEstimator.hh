@@ -0,0 +1,67 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file LZEstimator.hh
+ *
+ * `LZEstimator` class.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Rough estimate of how well data compresses with Deflate-like archivers (zip, 7z, ...).
+ *
+ * Data is parsed greedily into LZ77 matches in a 32 KiB window. Literals are costed by their order-0
+ * entropy and matches by approximate Deflate length and distance code sizes. Absolute numbers are
+ * only indicative, but comparing two encodings of the same texture is reliable.
+ */
+class LZEstimator
+{
+public:
+
+  /// Size of the sliding window.
+  static const int WINDOW_SIZE = 1 << 15;
+
+  /// Shortest and longest match.
+  static const int MIN_MATCH = 3;
+  static const int MAX_MATCH = 258;
+
+  /// Maximum number of earlier positions tried for each match.
+  static const int MAX_CHAIN = 32;
+
+public:
+
+  /**
+   * Forbid instances.
+   */
+  LZEstimator() = delete;
+
+  /**
+   * Estimated compressed size in bytes.
+   */
+  static size_t estimate(const uint8_t* data, size_t size);
+
+};
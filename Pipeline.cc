@@ -0,0 +1,192 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Pipeline.cc
+ */
+
+#include "Pipeline.hh"
+
+#include <atomic>
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+Pipeline::Status Pipeline::process(Stage stage, Item* item) const
+{
+  const JobScheduler::Job& job = item->job;
+
+  switch (stage) {
+    case READ: {
+      if (dropMipmaps && ImageBuilder::isDDSFile(job.file.c_str())) {
+        int level = ImageBuilder::mipmapLevel(job.file.c_str(), job.scale);
+
+        if (level >= 0) {
+          bool isSuccessful = ImageBuilder::dropMipmaps(job.file.c_str(), level,
+                                                        job.destFile.c_str());
+          return isSuccessful ? FINISHED : FAILED;
+        }
+      }
+
+      if (!ImageBuilder::readFile(job.file.c_str(), &item->data)) {
+        printf("Failed to open image '%s'.\n", job.file.c_str());
+        return FAILED;
+      }
+      return CONTINUE;
+    }
+    case DECODE: {
+      item->image = ImageBuilder::decodeImage(job.file.c_str(), item->data);
+      vector<char>().swap(item->data);
+
+      if (item->image.isEmpty()) {
+        printf("Failed to open image '%s'.\n", job.file.c_str());
+        return FAILED;
+      }
+      return CONTINUE;
+    }
+    case PROCESS: {
+      int  options      = ImageBuilder::optionsFor(item->image, job.options);
+      bool isSuccessful = ImageBuilder::prepareDDS(&item->image, 1, options, job.scale,
+                                                   &item->dds);
+
+      item->image = ImageData();
+      return isSuccessful ? CONTINUE : FAILED;
+    }
+    case COMPRESS: {
+      ImageBuilder::compressDDS(&item->dds);
+      return CONTINUE;
+    }
+    default: {
+      return ImageBuilder::writeDDS(item->dds, job.destFile.c_str()) ? FINISHED : FAILED;
+    }
+  }
+}
+
+Pipeline::Pipeline(const int* nWorkers_, bool dropMipmaps_) :
+  dropMipmaps(dropMipmaps_)
+{
+  for (int i = 0; i < N_STAGES; ++i) {
+    nWorkers[i] = max(nWorkers_[i], 1);
+  }
+}
+
+int Pipeline::run(JobScheduler* scheduler)
+{
+  typedef unique_ptr<Item>                 ItemPtr;
+  typedef unique_ptr<BoundedQueue<ItemPtr>> QueuePtr;
+
+  // Queue `i` feeds stage `i + 1` and holds at most one waiting item per worker of that stage.
+  vector<QueuePtr> queues;
+  atomic<int>      nRunning[N_STAGES];
+  atomic<int>      nFailed(0);
+  vector<thread>   threads;
+
+  for (int i = 1; i < N_STAGES; ++i) {
+    queues.emplace_back(new BoundedQueue<ItemPtr>(size_t(nWorkers[i])));
+  }
+
+  scheduler->close();
+
+  for (int i = 0; i < N_STAGES; ++i) {
+    Stage stage = Stage(i);
+
+    nRunning[i] = nWorkers[i];
+
+    for (int j = 0; j < nWorkers[i]; ++j) {
+      threads.emplace_back([this, stage, scheduler, &queues, &nRunning, &nFailed]
+      {
+        auto next = [&](ItemPtr* item)
+        {
+          if (stage != READ) {
+            return queues[size_t(stage - 1)]->pop(item);
+          }
+
+          JobScheduler::Job job;
+
+          if (!scheduler->acquire(&job)) {
+            return false;
+          }
+
+          item->reset(new Item());
+          (*item)->job = job;
+          return true;
+        };
+
+        ItemPtr item;
+
+        while (next(&item)) {
+          Status status = process(stage, item.get());
+
+          if (status == CONTINUE) {
+            queues[size_t(stage)]->push(move(item));
+          }
+          else {
+            nFailed += status == FAILED;
+            scheduler->release(item->job);
+            item.reset();
+          }
+        }
+
+        if (--nRunning[stage] == 0 && stage != WRITE) {
+          queues[size_t(stage)]->close();
+        }
+      });
+    }
+  }
+
+  for (thread& t : threads) {
+    t.join();
+  }
+  return nFailed;
+}
+
+void Pipeline::defaultWorkers(int nThreads, int* nWorkers)
+{
+  // Compression dominates, decoding and mipmap generation take roughly a quarter of that each. I/O
+  // workers mostly wait, two readers keep a prefetch in flight.
+  nWorkers[READ]     = 2;
+  nWorkers[DECODE]   = max(nThreads / 4, 1);
+  nWorkers[PROCESS]  = max(nThreads / 4, 1);
+  nWorkers[COMPRESS] = max(nThreads, 1);
+  nWorkers[WRITE]    = 1;
+}
+
+bool Pipeline::parseWorkers(const char* spec, int* nWorkers)
+{
+  stringstream ss(spec);
+
+  for (int i = 0; i < N_STAGES; ++i) {
+    char separator = ',';
+
+    if (i != 0) {
+      ss >> separator;
+    }
+    ss >> nWorkers[i];
+
+    if (ss.fail() || separator != ',' || nWorkers[i] < 1) {
+      return false;
+    }
+  }
+  return ss.eof() || (ss >> ws).eof();
+}
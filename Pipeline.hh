@@ -0,0 +1,192 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Pipeline.hh
+ *
+ * `BoundedQueue` and `Pipeline` classes.
+ */
+
+#pragma once
+
+#include "ImageBuilder.hh"
+#include "JobScheduler.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+/**
+ * Fixed-capacity FIFO between pipeline stages.
+ *
+ * `push()` blocks while the queue is full, which stalls the producing stage (backpressure), and
+ * `pop()` blocks while it is empty.
+ */
+template <typename Type>
+class BoundedQueue
+{
+private:
+
+  std::mutex              mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  std::deque<Type>        items;
+  size_t                  capacity;
+  bool                    isClosed = false;
+
+public:
+
+  /**
+   * Create an empty queue.
+   */
+  explicit BoundedQueue(size_t capacity_) :
+    capacity(capacity_ == 0 ? 1 : capacity_)
+  {}
+
+  /**
+   * Wait until there is room and append an item.
+   */
+  void push(Type item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    notFull.wait(lock, [this]
+    {
+      return items.size() < capacity;
+    });
+
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+  }
+
+  /**
+   * Wait for an item and take it.
+   *
+   * @return false iff the queue is closed and empty.
+   */
+  bool pop(Type* item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    notEmpty.wait(lock, [this]
+    {
+      return !items.empty() || isClosed;
+    });
+
+    if (items.empty()) {
+      return false;
+    }
+
+    *item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  /**
+   * Mark that no more items will be pushed.
+   */
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    isClosed = true;
+    notEmpty.notify_all();
+  }
+};
+
+/**
+ * Multi-file conversion split into stages that run concurrently on different files.
+ *
+ * Stages are reading source files, decoding them, processing (transformations and mipmaps), block
+ * compression and writing DDS files. Each has its own pool of workers and stages are connected by
+ * bounded queues, so a slow stage throttles the ones before it instead of piling up images in
+ * memory. Disk reads and writes thus overlap with decoding and compression of other files.
+ *
+ * Jobs are admitted from a `JobScheduler`, so total memory of images in flight stays within its
+ * budget.
+ */
+class Pipeline
+{
+public:
+
+  /// Pipeline stages.
+  enum Stage
+  {
+    READ,
+    DECODE,
+    PROCESS,
+    COMPRESS,
+    WRITE,
+    N_STAGES
+  };
+
+private:
+
+  enum Status
+  {
+    FAILED,
+    FINISHED,
+    CONTINUE
+  };
+
+  struct Item
+  {
+    JobScheduler::Job job;
+    std::vector<char> data;
+    ImageData         image;
+    DDSData           dds;
+  };
+
+  int  nWorkers[N_STAGES];
+  bool dropMipmaps;
+
+  Status process(Stage stage, Item* item) const;
+
+public:
+
+  /**
+   * Create a pipeline with a given number of workers for each stage.
+   *
+   * @param dropMipmaps use `ImageBuilder::dropMipmaps()` for DDS sources where possible.
+   */
+  explicit Pipeline(const int* nWorkers, bool dropMipmaps);
+
+  /**
+   * Close the scheduler and convert all its jobs.
+   *
+   * @return number of failed jobs.
+   */
+  int run(JobScheduler* scheduler);
+
+  /**
+   * Default numbers of workers for a given number of CPU threads.
+   */
+  static void defaultWorkers(int nThreads, int* nWorkers);
+
+  /**
+   * Parse comma-separated numbers of workers for all stages, e.g. "2,2,2,8,1".
+   */
+  static bool parseWorkers(const char* spec, int* nWorkers);
+
+};
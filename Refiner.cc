@@ -0,0 +1,208 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Refiner.cc
+ */
+
+#include "Refiner.hh"
+
+#include "File.hh"
+#include "ImageBuilder.hh"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+const char* const Refiner::SUFFIX      = ".pending";
+const char* const Refiner::DONE_SUFFIX = ".done";
+
+static string stateFileFor(const JobScheduler::Job& job, const char* suffix = Refiner::SUFFIX)
+{
+  return job.destFile + suffix;
+}
+
+static string absolutePath(const string& path)
+{
+#ifdef _WIN32
+  return path;
+#else
+  char buffer[PATH_MAX];
+  return realpath(path.c_str(), buffer) == nullptr ? path : string(buffer);
+#endif
+}
+
+// State file consists of options and scale on the first line and the source path on the second.
+static bool readState(const string& stateFile, JobScheduler::Job* job)
+{
+  ifstream is(stateFile);
+
+  is >> job->options >> job->scale;
+  is.ignore(1);
+
+  return is && getline(is, job->file) && !job->file.empty();
+}
+
+// Replace the state file atomically, the temporary name is unique among processes.
+static bool writeState(const string& stateFile, const JobScheduler::Job& job)
+{
+  string tempFile = stateFile + "." + to_string(getpid()) + ".tmp";
+  FILE*  f        = fopen(tempFile.c_str(), "w");
+
+  if (f == nullptr) {
+    printf("Failed to open for writing '%s'.\n", stateFile.c_str());
+    return false;
+  }
+
+  fprintf(f, "%d %.17g\n%s\n", job.options, job.scale, absolutePath(job.file).c_str());
+
+  bool isWritten = ferror(f) == 0;
+
+  isWritten &= fclose(f) == 0;
+
+  if (!isWritten || rename(tempFile.c_str(), stateFile.c_str()) != 0) {
+    printf("Failed to write '%s'.\n", stateFile.c_str());
+    remove(tempFile.c_str());
+    return false;
+  }
+  return true;
+}
+
+// True iff the state file records the same options, scale and source as the job.
+static bool isSameJob(const string& stateFile, const JobScheduler::Job& job)
+{
+  JobScheduler::Job state;
+
+  return readState(stateFile, &state) && state.options == job.options &&
+         state.scale == job.scale && state.file == absolutePath(job.file);
+}
+
+static bool isNewer(const string& file, const string& otherFile)
+{
+  struct stat info, otherInfo;
+
+  return stat(file.c_str(), &info) == 0 && stat(otherFile.c_str(), &otherInfo) == 0 &&
+         info.st_mtime >= otherInfo.st_mtime;
+}
+
+bool Refiner::isPending(const JobScheduler::Job& job)
+{
+  return isSameJob(stateFileFor(job), job) && isNewer(job.destFile, job.file);
+}
+
+bool Refiner::isUpToDate(const JobScheduler::Job& job)
+{
+  return isSameJob(stateFileFor(job, DONE_SUFFIX), job) && isNewer(job.destFile, job.file);
+}
+
+bool Refiner::markPending(const JobScheduler::Job& job)
+{
+  if (!writeState(stateFileFor(job), job)) {
+    return false;
+  }
+
+  remove(stateFileFor(job, DONE_SUFFIX).c_str());
+  return true;
+}
+
+void Refiner::markDone(const JobScheduler::Job& job)
+{
+  if (writeState(stateFileFor(job, DONE_SUFFIX), job)) {
+    remove(stateFileFor(job).c_str());
+  }
+}
+
+void Refiner::findPending(const char* dir, vector<JobScheduler::Job>* jobs)
+{
+  vector<string> files;
+  size_t         suffixLength = strlen(SUFFIX);
+
+  File::listRecursively(dir, &files);
+
+  for (const string& path : files) {
+    if (path.size() <= suffixLength ||
+        path.compare(path.size() - suffixLength, suffixLength, SUFFIX) != 0)
+    {
+      continue;
+    }
+
+    string            stateFile = string(dir) + "/" + path;
+    JobScheduler::Job job;
+    int               width, height;
+
+    job.destFile = stateFile.substr(0, stateFile.size() - suffixLength);
+
+    if (!readState(stateFile, &job)) {
+      printf("Invalid refinement state '%s'.\n", stateFile.c_str());
+    }
+    else if (!ImageBuilder::readSize(job.file.c_str(), &width, &height)) {
+      printf("Failed to open image '%s'.\n", job.file.c_str());
+    }
+    else {
+      job.memory = ImageBuilder::estimateMemory(width, height, job.options, job.scale);
+      jobs->push_back(job);
+    }
+  }
+}
+
+bool Refiner::detach()
+{
+#ifdef _WIN32
+  return false;
+#else
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    printf("Failed to start background process, refining in foreground.\n");
+    return false;
+  }
+  else if (pid != 0) {
+    printf("Refining in background process %d.\n", int(pid));
+    return true;
+  }
+
+  // Leave the terminal's session, so closing it or pressing Ctrl-C doesn't kill refinement.
+  setsid();
+  return false;
+#endif
+}
+
+void Refiner::lowerPriority()
+{
+#ifndef _WIN32
+  // On Linux this only applies to the calling thread, so it must precede starting workers.
+  errno = 0;
+
+  if (nice(10) == -1 && errno != 0) {
+    printf("Failed to lower process priority.\n");
+  }
+#endif
+}
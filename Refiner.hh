@@ -0,0 +1,105 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file Refiner.hh
+ *
+ * `Refiner` class.
+ */
+
+#pragma once
+
+#include "JobScheduler.hh"
+
+#include <string>
+#include <vector>
+
+/**
+ * Bookkeeping for progressive conversions.
+ *
+ * A progressive conversion first writes a preview DDS with `ImageBuilder::PREVIEW_BIT` and then
+ * converts the image again at full quality, replacing the preview. The full-quality job is recorded
+ * in a state file next to the output (`<destFile>.pending`) until it succeeds, so that an
+ * interrupted refinement can be finished later without redoing previews. The state file is then
+ * renamed to `<destFile>.done`, so a repeated run can tell which options the output was built with.
+ */
+class Refiner
+{
+public:
+
+  /// Suffix of state files of pending refinements.
+  static const char* const SUFFIX;
+
+  /// Suffix of state files of finished refinements.
+  static const char* const DONE_SUFFIX;
+
+public:
+
+  /**
+   * Forbid instances.
+   */
+  Refiner() = delete;
+
+  /**
+   * True iff a refinement of the job is recorded and the preview is not older than the source.
+   */
+  static bool isPending(const JobScheduler::Job& job);
+
+  /**
+   * True iff a finished refinement of the job with the same options and scale is recorded and its
+   * output is not older than the source.
+   */
+  static bool isUpToDate(const JobScheduler::Job& job);
+
+  /**
+   * Record that a job has to be refined. Source path is stored as absolute.
+   *
+   * Any finished refinement recorded for the same output is forgotten.
+   */
+  static bool markPending(const JobScheduler::Job& job);
+
+  /**
+   * Record that a job has been refined, replacing its pending state.
+   */
+  static void markDone(const JobScheduler::Job& job);
+
+  /**
+   * Read all recorded refinements in a directory tree.
+   */
+  static void findPending(const char* dir, std::vector<JobScheduler::Job>* jobs);
+
+  /**
+   * Continue in a detached background process, so the caller can return once previews are
+   * written.
+   *
+   * @return true in the original process, which should exit, false in the background process or if
+   * it cannot be started (Windows or `fork()` failure).
+   */
+  static bool detach();
+
+  /**
+   * Lower CPU priority of the calling process, so refinements don't slow down the game or editor
+   * that is using previews.
+   */
+  static void lowerPriority();
+
+};
@@ -0,0 +1,282 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file TextureReport.cc
+ */
+
+#include "TextureReport.hh"
+
+#include "File.hh"
+#include "ImageBuilder.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+
+struct Entry
+{
+  string      path;
+  string      mod;
+  TextureInfo info;
+  bool        isValid = false;
+};
+
+struct Group
+{
+  string name;
+  int    nTextures = 0;
+  size_t memory    = 0;
+};
+
+}
+
+static string stemOf(const string& path)
+{
+  return path.substr(0, path.rfind('.'));
+}
+
+static double toMiB(size_t bytes)
+{
+  return double(bytes) / (1024.0 * 1024.0);
+}
+
+static string jsonString(const string& s)
+{
+  string result = "\"";
+
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    }
+    else if (static_cast<unsigned char>(c) < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      result += escape;
+    }
+    else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+static vector<Group> sortGroups(const map<string, Group>& groups)
+{
+  vector<Group> sorted;
+
+  for (const auto& i : groups) {
+    sorted.push_back(i.second);
+  }
+  sort(sorted.begin(), sorted.end(), [](const Group& a, const Group& b)
+  {
+    return a.memory > b.memory;
+  });
+  return sorted;
+}
+
+static void printGroups(const char* title, const vector<Group>& groups, size_t total)
+{
+  printf("\n%s\n", title);
+
+  for (const Group& group : groups) {
+    printf("  %9.1f MiB  %5.1f%%  %6d  %s\n",
+           toMiB(group.memory),
+           total == 0 ? 0.0 : 100.0 * double(group.memory) / double(total),
+           group.nTextures,
+           group.name.c_str());
+  }
+}
+
+static void printJSONGroups(const char* title, const vector<Group>& groups)
+{
+  printf("  \"%s\": [", title);
+
+  for (size_t i = 0; i < groups.size(); ++i) {
+    printf("%s\n    { \"name\": %s, \"textures\": %d, \"bytes\": %llu }",
+           i == 0 ? "" : ",",
+           jsonString(groups[i].name).c_str(),
+           groups[i].nTextures,
+           static_cast<unsigned long long>(groups[i].memory));
+  }
+  printf("\n  ],\n");
+}
+
+bool TextureReport::print(char** dirs, int nDirs, int nThreads, bool json)
+{
+  vector<Entry> entries;
+
+  for (int i = 0; i < nDirs; ++i) {
+    if (!File::isDirectory(dirs[i])) {
+      printf("Not a directory '%s'.\n", dirs[i]);
+      return false;
+    }
+
+    vector<string> files;
+    set<string>    ddsStems;
+
+    File::listRecursively(dirs[i], &files);
+
+    for (const string& file : files) {
+      if (ImageBuilder::isDDSFile(file.c_str())) {
+        ddsStems.insert(stemOf(file));
+      }
+    }
+
+    for (const string& file : files) {
+      // A source image next to its converted DDS is not loaded by the game, only the DDS is.
+      if (!File::isImage(file.c_str()) ||
+          (!ImageBuilder::isDDSFile(file.c_str()) && ddsStems.count(stemOf(file)) != 0))
+      {
+        continue;
+      }
+
+      size_t slash = file.find('/');
+
+      entries.push_back(Entry());
+      entries.back().path = string(dirs[i]) + "/" + file;
+      entries.back().mod  = slash == string::npos ? "." : file.substr(0, slash);
+    }
+  }
+
+  // Headers are read in parallel, each thread takes the next unread entry.
+  atomic<size_t> next(0);
+  vector<thread> threads;
+
+  for (int i = 0; i < max(nThreads, 1); ++i) {
+    threads.emplace_back([&entries, &next]
+    {
+      for (size_t j = next++; j < entries.size(); j = next++) {
+        Entry& entry = entries[j];
+        entry.isValid = ImageBuilder::readTextureInfo(entry.path.c_str(), &entry.info);
+      }
+    });
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+
+  map<string, Group> mods;
+  map<string, Group> formats;
+  vector<Entry*>     largest;
+  size_t             total    = 0;
+  int                nValid   = 0;
+  int                nInvalid = 0;
+
+  for (Entry& entry : entries) {
+    if (!entry.isValid) {
+      ++nInvalid;
+      continue;
+    }
+
+    Group& mod    = mods[entry.mod];
+    Group& format = formats[entry.info.format];
+
+    mod.name          = entry.mod;
+    mod.nTextures    += 1;
+    mod.memory       += entry.info.memory;
+
+    format.name       = entry.info.format;
+    format.nTextures += 1;
+    format.memory    += entry.info.memory;
+
+    total += entry.info.memory;
+    ++nValid;
+
+    largest.push_back(&entry);
+  }
+
+  size_t nLargest = min(largest.size(), size_t(N_LARGEST));
+
+  partial_sort(largest.begin(), largest.begin() + ptrdiff_t(nLargest), largest.end(),
+               [](const Entry* a, const Entry* b)
+  {
+    return a->info.memory > b->info.memory;
+  });
+  largest.resize(nLargest);
+
+  vector<Group> sortedMods    = sortGroups(mods);
+  vector<Group> sortedFormats = sortGroups(formats);
+
+  if (json) {
+    printf("{\n");
+    printf("  \"textures\": %d,\n", nValid);
+    printf("  \"unreadable\": %d,\n", nInvalid);
+    printf("  \"bytes\": %llu,\n", static_cast<unsigned long long>(total));
+
+    printJSONGroups("mods", sortedMods);
+    printJSONGroups("formats", sortedFormats);
+
+    printf("  \"largest\": [");
+
+    for (size_t i = 0; i < largest.size(); ++i) {
+      const TextureInfo& info = largest[i]->info;
+
+      printf("%s\n    { \"file\": %s, \"format\": %s, \"width\": %d, \"height\": %d, "
+             "\"mipmaps\": %d, \"faces\": %d, \"bytes\": %llu }",
+             i == 0 ? "" : ",",
+             jsonString(largest[i]->path).c_str(),
+             jsonString(info.format).c_str(),
+             info.width,
+             info.height,
+             info.nMipmaps,
+             info.nFaces,
+             static_cast<unsigned long long>(info.memory));
+    }
+    printf("\n  ]\n}\n");
+  }
+  else {
+    printf("Total  %.1f MiB in %d textures", toMiB(total), nValid);
+
+    if (nInvalid != 0) {
+      printf(" (%d unreadable)", nInvalid);
+    }
+    printf("\n");
+
+    printGroups("By mod", sortedMods, total);
+    printGroups("By format", sortedFormats, total);
+
+    printf("\nLargest textures\n");
+
+    for (const Entry* entry : largest) {
+      printf("  %9.1f MiB  %-4s  %4dx%-4d  %2d mipmaps  %s\n",
+             toMiB(entry->info.memory),
+             entry->info.format,
+             entry->info.width,
+             entry->info.height,
+             entry->info.nMipmaps,
+             entry->path.c_str());
+    }
+  }
+  return true;
+}
@@ -0,0 +1,63 @@
+/*
+ * img2dds - DDS image builder.
+ *
+ * Copyright © 2002-2014 Davorin Učakar
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgement in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/**
+ * @file TextureReport.hh
+ *
+ * `TextureReport` class.
+ */
+
+#pragma once
+
+/**
+ * %TextureReport summarises GPU memory usage of all textures inside directory trees.
+ *
+ * Only image headers are read, so a whole `GameData/` can be scanned in seconds. Memory is
+ * aggregated per mod (the first directory level) and per pixel format and the largest textures are
+ * listed. Source images that have a DDS with the same name next to them are skipped, as only the
+ * DDS is loaded.
+ */
+class TextureReport
+{
+public:
+
+  /// Number of largest textures listed in the report.
+  static const int N_LARGEST = 20;
+
+public:
+
+  /**
+   * Forbid instances.
+   */
+  TextureReport() = delete;
+
+  /**
+   * Scan directories in parallel and print the report as plain text or JSON.
+   *
+   * @param dirs root directories, mods are their immediate subdirectories.
+   * @param nDirs number of directories.
+   * @param nThreads number of threads reading headers.
+   * @param json print in JSON format.
+   */
+  static bool print(char** dirs, int nDirs, int nThreads, bool json);
+
+};
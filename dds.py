@@ -9,6 +9,20 @@
 #   ./dds.py
 #
 # in case this is located inside KSP directory.
+#
+# To fit all converted textures into a given amount of GPU memory, pass a budget in MiB
+#
+#   ./dds.py --budget 2048 [/path/to/GameData]
+#
+# and scales are chosen automatically instead of using MODEL_SCALE and MODEL_NORMALS_SCALE. Normal
+# maps are shrunk first, then other model textures and UI textures last.
+#
+# To keep converting textures while working on them, run
+#
+#   ./dds.py --watch [/path/to/GameData]
+#
+# and every image written under GameData is converted next to its source within a second, using the
+# same rules as below. Sources are kept. Linux only, stop with Ctrl+C.
 
 # The following regex patterens must match the beginning of a texture path (after `GameData/`).
 
@@ -109,7 +123,7 @@ MODEL_NORMALS_SCALE = 1.0
 
 ####################################################################################################
 
-import os, re, sys
+import os, re, sys, tempfile, time
 
 EXCLUDE   = [re.compile(e) for e in EXCLUDE]
 MODEL     = [re.compile(m) for m in MODEL]
@@ -122,8 +136,32 @@ SYSTEM    = 'win32' if sys.platform == 'win32' else SYSTEM
 SYSTEM    = 'osx64' if sys.platform == 'darwin' else SYSTEM
 IMG2DDS   = './img2dds/' + SYSTEM + '/img2dds'
 IMG2DDS   = 'img2dds\win32\img2dds.exe' if SYSTEM == 'win32' else IMG2DDS
-DIR       = sys.argv[1] if len(sys.argv) == 2 else './GameData'
+ARGS      = sys.argv[1:]
+WATCH     = len(ARGS) >= 1 and ARGS[0] == '--watch'
+ARGS      = ARGS[1:] if WATCH else ARGS
+BUDGET    = ARGS[1] if len(ARGS) >= 2 and ARGS[0] == '--budget' else None
+ARGS      = ARGS[2:] if BUDGET else ARGS
+DIR       = ARGS[0] if len(ARGS) == 1 else './GameData'
 BASEDIR   = re.compile('^(.*GameData).*').sub('\\1', DIR)
+budgetList = []
+
+if WATCH:
+  rules  = ['skip ' + e.pattern for e in EXCLUDE]
+  rules += ['ui ' + m.pattern for m in NOT_MODEL]
+  rules += ['model ' + m.pattern for m in MODEL]
+  rules += ['normals ' + NORMAL.pattern,
+            'options model vcm ' + str(MODEL_SCALE),
+            'options normal vcmns ' + str(MODEL_NORMALS_SCALE)]
+
+  (rulesFd, rulesPath) = tempfile.mkstemp(suffix = '.txt')
+  with os.fdopen(rulesFd, 'w') as rulesFile:
+    rulesFile.write('\n'.join(rules) + '\n')
+
+  try:
+    os.system(IMG2DDS + ' -W -L "' + rulesPath + '" "' + BASEDIR + '"')
+  finally:
+    os.remove(rulesPath)
+  sys.exit(0)
 
 for (dirPath, dirNames, fileNames) in os.walk(DIR):
   dirPath = PREFIX.sub('', dirPath.replace('\\', '/'))
@@ -138,6 +176,15 @@ for (dirPath, dirNames, fileNames) in os.walk(DIR):
     isNormal = i in normals or os.system(IMG2DDS + ' -N "' + path + '"') == 0
     options  = '-vc'
 
+    if BUDGET:
+      if i not in models:
+        budgetList.append('ui vc ' + path)
+      elif isNormal:
+        budgetList.append('normal vcmns ' + path)
+      else:
+        budgetList.append('model vcm ' + path)
+      continue
+
     if i in models:
       options += 'mnsr ' + str(MODEL_NORMALS_SCALE) if isNormal else 'mr ' + str(MODEL_SCALE)
 
@@ -146,6 +193,25 @@ for (dirPath, dirNames, fileNames) in os.walk(DIR):
     else:
       print('FAILED to convert ' + path)
 
+if BUDGET and budgetList:
+  (listFd, listPath) = tempfile.mkstemp(suffix = '.txt')
+  with os.fdopen(listFd, 'w') as listFile:
+    listFile.write('\n'.join(budgetList) + '\n')
+
+  # A DDS left from an earlier run doesn't mean this conversion succeeded, it must be written now.
+  # Whole seconds, as some filesystems store coarser modification times.
+  startTime = int(time.time())
+  os.system(IMG2DDS + ' -B ' + BUDGET + ' "' + listPath + '"')
+  os.remove(listPath)
+
+  for entry in budgetList:
+    path    = entry.split(' ', 2)[2]
+    ddsPath = os.path.splitext(path)[0] + '.dds'
+    if os.path.exists(ddsPath) and os.path.getmtime(ddsPath) >= startTime:
+      os.remove(path)
+    else:
+      print('FAILED to convert ' + path)
+
 if SYSTEM == 'win32' and not sys.stdin.closed:
   print('Finished. Press Enter to continue ...')
   sys.stdin.readline()
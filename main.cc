@@ -20,14 +20,32 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+#include "ArrayPacker.hh"
+#include "BC7Encoder.hh"
+#include "BudgetPlanner.hh"
+#include "ConversionRules.hh"
+#include "Coordinator.hh"
+#include "File.hh"
+#include "FileWatcher.hh"
 #include "ImageBuilder.hh"
+#include "JobScheduler.hh"
+#include "Pipeline.hh"
+#include "Refiner.hh"
+#include "TextureReport.hh"
 
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 
 using namespace std;
 
@@ -35,45 +53,508 @@ static void printUsage()
 {
   printf(
     "Usage: ozDDS [options] <inputImage> [<outputDirOrFile>]\n"
+    "       ozDDS [options] -j <threads> [-P <workers>] [-M <MiB>] <inputImage> ...\n"
     "       ozDDS [-I | -N] <inputImage>\n"
+    "       ozDDS -R [-J] [-j <threads>] <directory> ...\n"
+    "       ozDDS [options] -p <processes> [-E <command>]... [-T <seconds>] [-M <MiB>]\n"
+    "             <inputImage> ...\n"
+    "       ozDDS -B <MiB> [-j <threads>] [-P <workers>] [-M <MiB>] <listFile>\n"
+    "       ozDDS -W [-L <rulesFile>] [-j <threads>] [-M <MiB>] <directory>\n"
+    "       ozDDS -A [options] [-j <threads>] <directory> [<outputDir>]\n"
+    "       ozDDS -Q [-j <threads> | -p <processes>] [-M <MiB>] <directory> ...\n"
     "\n"
     "  -I          Print information about a DDS image and exit\n"
+    "  -R          Print GPU memory usage of all textures in given directories, by mod and format\n"
+    "  -J          Print -R report in JSON format\n"
     "  -N          Detect normal map (RGB = XYZ) and exit (zero exit code if it is)\n"
     "  -h          Flip horizontally\n"
     "  -v          Flip vertically\n\n"
     "  -r <scale>  Resize to the give scale\n"
+    "  -d          For DDS input, resize by dropping top mipmap levels if scale matches a level\n"
+    "              (no re-encoding, other options are ignored in that case)\n"
     "  -c          Compress as DXT1 (opaque) or DXT5 (transparent)\n"
+    "  -b          Compress as BC7 (DX10 header, for D3D11+ and recent OpenGL)\n"
+    "  -e <speed>  BC7 encoder speed: 0 = fast, 1 = normal (default), 2 = best\n"
+    "  -z <error>  Rate-distortion optimise compressed blocks so files zip better, allowing RMS\n"
+    "              error to grow by up to the given number of 8-bit levels (e.g. 2-8)\n"
     "  -m          Generate mipmaps\n"
     "  -n          Set normal map flag (DDPF_NORMAL)\n"
     "  -s          Do RGB -> GGGR swizzle (for DXT5nm), ignored for MBM normal maps\n"
     "  -S          Do RGB -> BGBR swizzle (for DXT5nm+z), ignored for MBM normal maps\n"
+    "  -j <n>      Convert all given images next to their sources using n threads\n"
+    "              (0 = number of CPU cores)\n"
+    "  -P <r,d,p,c,w>\n"
+    "              Numbers of workers for read, decode, process (mipmaps), compress and write\n"
+    "              stages of -j and -B conversions (default 2,n/4,n/4,n,1 for n threads)\n"
+    "  -p <n>      Convert like -j (also for -B), but in n worker processes (0 = number of CPU\n"
+    "              cores), so a crash only loses one image, which is then retried up to 2 times\n"
+    "  -E <cmd>    Command that starts a worker for -p, e.g. 'ssh host img2dds' for a host that\n"
+    "              shares the filesystem. May be repeated, workers are spread over commands.\n"
+    "  -T <sec>    Fail images that take longer than the given number of seconds in -p mode\n"
+    "  -w          Worker mode, used internally by -p\n"
+    "  -M <MiB>    Memory budget for parallel conversions (default is half of RAM)\n"
+    "  -B <MiB>    Convert images listed in a file (- for stdin), choosing scales so that all\n"
+    "              textures fit into the given GPU memory. Each line has the form\n"
+    "              '<class> <options> <inputImage>' where class is normal, model or ui (the\n"
+    "              order in which they get shrunk) and options are letters of the flags above,\n"
+    "              e.g. 'vcmns' (- for none).\n"
+    "  -W          Watch a directory and convert images next to their sources whenever they are\n"
+    "              written, until interrupted (Linux only)\n"
+    "  -L <file>   Rules for -W, one per line: 'skip|ui|model <regex>' assigns a class by path\n"
+    "              (first match wins, default ui), 'normals <regex>' marks model normal maps by\n"
+    "              name (others are detected by pixels) and 'options ui|model|normal <letters>\n"
+    "              [<scale>]' sets options per class (defaults: vc, vcm, vcmns).\n"
+    "  -A          Pack images up to 256x256 from a directory into DX10 texture arrays, one per\n"
+    "              size and alpha class, each with a .txt file listing '<slice> <image>'\n"
+    "  -q          Progressive single, -j or -p conversion: quickly write previews (range fit,\n"
+    "              box filtered mipmaps, fastest BC7, no RDO), then convert again at full quality\n"
+    "              in a low-priority background process that replaces previews as it goes.\n"
+    "              Pending refinements are recorded in <output>.pending files and finished ones\n"
+    "              in <output>.done. A repeated run keeps previews that are still up to date and\n"
+    "              skips finished outputs with the same options that are newer than their\n"
+    "              sources.\n"
+    "  -Q          Finish pending refinements of interrupted -q runs in given directories (also\n"
+    "              with -p)\n"
+    "\n"
+    "Pixel kernels use the best instruction set the CPU supports. To force a specific one, set\n"
+    "IMG2DDS_ISA environment variable to baseline, avx2 or avx512.\n"
     "\n");
 }
 
+static string destFileFor(const char* file)
+{
+  const char* dot = strrchr(file, '.');
+
+  if (dot == nullptr) {
+    printf("File extensfion missing: '%s'.\n", file);
+    return "";
+  }
+  return string(file, size_t(dot - file)) + ".dds";
+}
+
+static string shellQuote(const char* s)
+{
+  string quoted = "'";
+
+  for (const char* c = s; *c != '\0'; ++c) {
+    quoted += *c == '\'' ? string("'\\''") : string(1, *c);
+  }
+  return quoted + "'";
+}
+
+static bool convertImage(ImageData* image, const char* destFile, int ddsOptions, double scale)
+{
+  ddsOptions = ImageBuilder::optionsFor(*image, ddsOptions);
+  return ImageBuilder::createDDS(image, 1, ddsOptions, scale, destFile);
+}
+
+static bool convert(const char* file, const char* destFile, int ddsOptions, double scale,
+                    bool dropMipmaps)
+{
+  if (dropMipmaps && ImageBuilder::isDDSFile(file)) {
+    int level = ImageBuilder::mipmapLevel(file, scale);
+
+    if (level >= 0) {
+      return ImageBuilder::dropMipmaps(file, level, destFile);
+    }
+  }
+
+  ImageData image = ImageBuilder::loadImage(file);
+
+  if (image.isEmpty()) {
+    printf("Failed to open image '%s'.\n", file);
+    return false;
+  }
+
+  return convertImage(&image, destFile, ddsOptions, scale);
+}
+
+static int runJobs(const vector<JobScheduler::Job>& jobs, bool dropMipmaps, const int* nWorkers,
+                   size_t memoryBudget, Coordinator* coordinator)
+{
+  if (coordinator != nullptr) {
+    return coordinator->run(jobs);
+  }
+
+  JobScheduler scheduler(memoryBudget);
+
+  for (const JobScheduler::Job& job : jobs) {
+    scheduler.add(job);
+  }
+  return Pipeline(nWorkers, dropMipmaps).run(&scheduler);
+}
+
+static bool makeJob(const char* file, const string& destFile, int ddsOptions, double scale,
+                    JobScheduler::Job* job)
+{
+  int width, height;
+
+  job->file     = file;
+  job->destFile = destFile;
+  job->options  = ddsOptions;
+  job->scale    = scale;
+
+  if (destFile.empty()) {
+    return false;
+  }
+  else if (!ImageBuilder::readSize(file, &width, &height)) {
+    printf("Failed to open image '%s'.\n", file);
+    return false;
+  }
+
+  job->memory = ImageBuilder::estimateMemory(width, height, ddsOptions, scale);
+  return true;
+}
+
+static int convertAll(char** files, int nFiles, int ddsOptions, double scale, bool dropMipmaps,
+                      const int* nWorkers, size_t memoryBudget, Coordinator* coordinator)
+{
+  vector<JobScheduler::Job> jobs;
+  int                       nFailed = 0;
+
+  for (int i = 0; i < nFiles; ++i) {
+    JobScheduler::Job job;
+
+    if (makeJob(files[i], destFileFor(files[i]), ddsOptions, scale, &job)) {
+      jobs.push_back(job);
+    }
+    else {
+      ++nFailed;
+    }
+  }
+
+  nFailed += runJobs(jobs, dropMipmaps, nWorkers, memoryBudget, coordinator);
+
+  if (nFailed != 0) {
+    printf("Failed to convert %d of %d images.\n", nFailed, nFiles);
+  }
+  return nFailed;
+}
+
+static int refine(const vector<JobScheduler::Job>& jobs, bool dropMipmaps, int nThreads,
+                  size_t memoryBudget, Coordinator* coordinator)
+{
+  // Worker processes are started by the coordinator afterwards, so they inherit the priority.
+  Refiner::lowerPriority();
+
+  if (coordinator != nullptr) {
+    return coordinator->run(jobs, Refiner::markDone);
+  }
+
+  JobScheduler scheduler(memoryBudget);
+
+  for (const JobScheduler::Job& job : jobs) {
+    scheduler.add(job);
+  }
+
+  int nFailed = scheduler.run(nThreads, [dropMipmaps](const JobScheduler::Job& job)
+  {
+    if (!convert(job.file.c_str(), job.destFile.c_str(), job.options, job.scale, dropMipmaps)) {
+      return false;
+    }
+
+    Refiner::markDone(job);
+    return true;
+  });
+
+  printf("Refined %d of %d images.\n", int(jobs.size()) - nFailed, int(jobs.size()));
+  return nFailed;
+}
+
+static int refineAll(char** dirs, int nDirs, bool dropMipmaps, int nThreads, size_t memoryBudget,
+                     Coordinator* coordinator)
+{
+  vector<JobScheduler::Job> jobs;
+
+  for (int i = 0; i < nDirs; ++i) {
+    Refiner::findPending(dirs[i], &jobs);
+  }
+  return refine(jobs, dropMipmaps, nThreads, memoryBudget, coordinator);
+}
+
+// `destFile` overrides the output of a single image, otherwise DDS files are written next to
+// sources. Returns the number of failed previews in the original process and the number of failed
+// refinements in the background one.
+static int convertProgressive(char** files, int nFiles, const char* destFile, int ddsOptions,
+                              double scale, bool dropMipmaps, const int* nWorkers, int nThreads,
+                              size_t memoryBudget, Coordinator* coordinator)
+{
+  vector<JobScheduler::Job> jobs;
+  vector<JobScheduler::Job> previews;
+  int                       nFailed = 0;
+
+  for (int i = 0; i < nFiles; ++i) {
+    JobScheduler::Job job;
+    string            dest = destFile == nullptr ? destFileFor(files[i]) : string(destFile);
+
+    if (!makeJob(files[i], dest, ddsOptions, scale, &job)) {
+      ++nFailed;
+      continue;
+    }
+
+    // Finished outputs are left alone. Previews of an earlier, interrupted run are kept and only
+    // their refinement is redone.
+    if (Refiner::isUpToDate(job)) {
+      continue;
+    }
+    else if (!Refiner::isPending(job)) {
+      if (!Refiner::markPending(job)) {
+        ++nFailed;
+        continue;
+      }
+
+      previews.push_back(job);
+      previews.back().options |= ImageBuilder::PREVIEW_BIT;
+    }
+    jobs.push_back(job);
+  }
+
+  if (!previews.empty()) {
+    int nFailedPreviews = runJobs(previews, dropMipmaps, nWorkers, memoryBudget, coordinator);
+
+    printf("Wrote %d of %d previews.\n", int(previews.size()) - nFailedPreviews,
+           int(previews.size()));
+
+    if (jobs.empty() || Refiner::detach()) {
+      return nFailed + nFailedPreviews;
+    }
+  }
+  else if (jobs.empty()) {
+    return nFailed;
+  }
+  return nFailed + refine(jobs, dropMipmaps, nThreads, memoryBudget, coordinator);
+}
+
+static int convertBudget(const char* listFile, size_t textureBudget, bool dropMipmaps,
+                         const int* nWorkers, size_t memoryBudget, Coordinator* coordinator)
+{
+  ifstream      fileStream;
+  istream*      is      = &cin;
+  BudgetPlanner planner;
+  int           nFailed = 0;
+
+  if (strcmp(listFile, "-") != 0) {
+    fileStream.open(listFile);
+    is = &fileStream;
+
+    if (!fileStream.is_open()) {
+      printf("Failed to open list '%s'.\n", listFile);
+      return 1;
+    }
+  }
+
+  string line;
+  while (getline(*is, line)) {
+    stringstream ss(line);
+    string       priorityName, options, file;
+
+    ss >> priorityName >> options >> ws;
+    getline(ss, file);
+
+    if (priorityName.empty() || priorityName[0] == '#') {
+      continue;
+    }
+
+    BudgetPlanner::Texture texture;
+    texture.file = file;
+
+    if (file.empty() || !BudgetPlanner::parsePriority(priorityName.c_str(), &texture.priority)) {
+      printf("Invalid list entry '%s'.\n", line.c_str());
+      ++nFailed;
+      continue;
+    }
+
+    texture.options = ConversionRules::parseOptions(options);
+
+    if (!ImageBuilder::readSize(file.c_str(), &texture.width, &texture.height,
+                                &texture.hasAlpha))
+    {
+      printf("Failed to open image '%s'.\n", file.c_str());
+      ++nFailed;
+      continue;
+    }
+
+    planner.add(texture);
+  }
+
+  if (!planner.plan(textureBudget)) {
+    printf("Textures exceed the budget even at minimum scales.\n");
+  }
+
+  vector<JobScheduler::Job> jobs;
+
+  for (const BudgetPlanner::Texture& texture : planner.getTextures()) {
+    JobScheduler::Job job;
+
+    job.file     = texture.file;
+    job.destFile = destFileFor(texture.file.c_str());
+    job.options  = texture.options;
+    job.scale    = texture.scale;
+    job.memory   = ImageBuilder::estimateMemory(texture.width, texture.height, texture.options,
+                                                texture.scale);
+
+    if (job.destFile.empty()) {
+      ++nFailed;
+    }
+    else {
+      jobs.push_back(job);
+    }
+  }
+
+  nFailed += runJobs(jobs, dropMipmaps, nWorkers, memoryBudget, coordinator);
+
+  planner.printAllocation(textureBudget);
+
+  if (nFailed != 0) {
+    printf("Failed to convert %d images.\n", nFailed);
+  }
+  return nFailed;
+}
+
+static void onSignal(int)
+{}
+
+static int watch(const char* dir, const char* rulesFile, int nThreads, size_t memoryBudget)
+{
+  ConversionRules rules;
+  FileWatcher     watcher;
+
+  if ((rulesFile != nullptr && !rules.load(rulesFile)) || !watcher.init(dir)) {
+    return 1;
+  }
+
+  // Interrupt waiting for changes instead of killing the process, so running conversions finish.
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  JobScheduler scheduler(memoryBudget);
+  mutex        queuedMutex;
+  set<string>  queued;
+  size_t       prefixLength = strlen(dir) + 1;
+
+  scheduler.start(nThreads, [&](const JobScheduler::Job& job)
+  {
+    {
+      // Once started, further changes to the file must queue a new conversion.
+      lock_guard<mutex> lock(queuedMutex);
+      queued.erase(job.file);
+    }
+
+    ImageData image = ImageBuilder::loadImage(job.file.c_str());
+
+    if (image.isEmpty()) {
+      printf("Failed to open image '%s'.\n", job.file.c_str());
+      return false;
+    }
+
+    string                 path = job.file.substr(prefixLength);
+    ConversionRules::Class type = rules.classify(path);
+
+    if (type == ConversionRules::MODEL && (rules.isNormalName(path) || image.isNormalMap())) {
+      type = ConversionRules::NORMAL_MAP;
+    }
+
+    return convertImage(&image, job.destFile.c_str(), rules.getOptions(type), rules.getScale(type));
+  });
+
+  printf("Watching '%s' ...\n", dir);
+
+  vector<string> files;
+
+  while (watcher.wait(&files)) {
+    for (const string& path : files) {
+      ConversionRules::Class type = rules.classify(path);
+      JobScheduler::Job      job;
+      int                    width, height;
+
+      job.file = string(dir) + "/" + path;
+
+      // Our own outputs are DDS files, never convert them again.
+      if (!File::isImage(path.c_str()) || type == ConversionRules::SKIP ||
+          ImageBuilder::isDDSFile(job.file.c_str()))
+      {
+        continue;
+      }
+
+      job.destFile = destFileFor(job.file.c_str());
+      job.options  = rules.getOptions(type);
+      job.scale    = rules.getScale(type);
+
+      if (job.destFile.empty() || !ImageBuilder::readSize(job.file.c_str(), &width, &height)) {
+        printf("Failed to open image '%s'.\n", job.file.c_str());
+        continue;
+      }
+
+      job.memory = ImageBuilder::estimateMemory(width, height, job.options, job.scale);
+
+      lock_guard<mutex> lock(queuedMutex);
+
+      if (queued.insert(job.file).second) {
+        scheduler.add(job);
+      }
+    }
+    files.clear();
+  }
+
+  printf("Finishing queued conversions ...\n");
+  return scheduler.wait();
+}
+
 int main(int argc, char** argv)
 {
   int    ddsOptions    = 0;
   double scale         = 1.0;
   bool   detectNormals = false;
   bool   printInfo     = false;
+  bool   dropMipmaps   = false;
+  bool   printReport   = false;
+  bool   jsonReport    = false;
+  bool   watchDir      = false;
+  bool   packArrays    = false;
+  bool   progressive   = false;
+  bool   refinePending = false;
+  bool   isWorker      = false;
+  char*  rulesFile     = nullptr;
+  size_t textureBudget = 0;
+  int    nThreads      = -1;
+  int    bc7Speed      = BC7Encoder::NORMAL;
+  double rdoError      = 0.0;
+  int    nProcesses    = -1;
+  double jobTimeout    = 0.0;
+  int    nWorkers[Pipeline::N_STAGES];
+  bool   hasWorkers    = false;
+  size_t memoryBudget  = JobScheduler::defaultBudget();
+
+  vector<string> workerCommands;
 
   int opt;
-  while ((opt = getopt(argc, argv, "INhvr:cmsSn")) >= 0) {
+  while ((opt = getopt(argc, argv, "IRJNhvr:dcbe:z:msSnj:P:p:E:T:wM:B:WL:AqQ")) >= 0) {
     switch (opt) {
       case 'I': {
         printInfo = true;
         break;
       }
-      case 'N': {
-        detectNormals = true;
+      case 'R': {
+        printReport = true;
         break;
       }
-      case 'h': {
-        ddsOptions |= ImageBuilder::FLOP_BIT;
+      case 'J': {
+        jsonReport = true;
         break;
       }
-      case 'v': {
-        ddsOptions |= ImageBuilder::FLIP_BIT;
+      case 'N': {
+        detectNormals = true;
+        break;
+      }
+      case 'h':
+      case 'v':
+      case 'c':
+      case 'b':
+      case 'm':
+      case 's':
+      case 'S':
+      case 'n': {
+        ddsOptions |= ConversionRules::optionBit(char(opt));
         break;
       }
       case 'r': {
@@ -82,24 +563,99 @@ int main(int argc, char** argv)
         scale = ss.fail() ? 1.0 : scale;
         break;
       }
-      case 'c': {
-        ddsOptions |= ImageBuilder::COMPRESSION_BIT;
+      case 'd': {
+        dropMipmaps = true;
+        break;
+      }
+      case 'e': {
+        stringstream ss(optarg);
+        ss >> bc7Speed;
+
+        if (ss.fail() || bc7Speed < BC7Encoder::FAST || bc7Speed > BC7Encoder::BEST) {
+          printUsage();
+          return EXIT_FAILURE;
+        }
+        break;
+      }
+      case 'z': {
+        stringstream ss(optarg);
+        ss >> rdoError;
+        rdoError = ss.fail() ? 0.0 : rdoError;
+        ImageBuilder::setRDOError(rdoError);
         break;
       }
-      case 'm': {
-        ddsOptions |= ImageBuilder::MIPMAPS_BIT;
+      case 'j': {
+        stringstream ss(optarg);
+        ss >> nThreads;
+        nThreads = ss.fail() || nThreads < 0 ? 0 : nThreads;
         break;
       }
-      case 's': {
-        ddsOptions |= ImageBuilder::YYYX_BIT;
+      case 'P': {
+        hasWorkers = Pipeline::parseWorkers(optarg, nWorkers);
+
+        if (!hasWorkers) {
+          printUsage();
+          return EXIT_FAILURE;
+        }
         break;
       }
-      case 'S': {
-        ddsOptions |= ImageBuilder::ZYZX_BIT;
+      case 'p': {
+        stringstream ss(optarg);
+        ss >> nProcesses;
+        nProcesses = ss.fail() || nProcesses < 0 ? 0 : nProcesses;
         break;
       }
-      case 'n': {
-        ddsOptions |= ImageBuilder::NORMAL_MAP_BIT;
+      case 'E': {
+        workerCommands.push_back(optarg);
+        break;
+      }
+      case 'T': {
+        stringstream ss(optarg);
+        ss >> jobTimeout;
+        jobTimeout = ss.fail() ? 0.0 : jobTimeout;
+        break;
+      }
+      case 'w': {
+        isWorker = true;
+        break;
+      }
+      case 'M': {
+        stringstream ss(optarg);
+        double mibs;
+        ss >> mibs;
+        memoryBudget = ss.fail() || mibs <= 0.0 ? 0 : size_t(mibs * 1024.0 * 1024.0);
+        break;
+      }
+      case 'B': {
+        stringstream ss(optarg);
+        double mibs;
+        ss >> mibs;
+
+        if (ss.fail() || mibs <= 0.0) {
+          printUsage();
+          return EXIT_FAILURE;
+        }
+        textureBudget = size_t(mibs * 1024.0 * 1024.0);
+        break;
+      }
+      case 'W': {
+        watchDir = true;
+        break;
+      }
+      case 'L': {
+        rulesFile = optarg;
+        break;
+      }
+      case 'A': {
+        packArrays = true;
+        break;
+      }
+      case 'q': {
+        progressive = true;
+        break;
+      }
+      case 'Q': {
+        refinePending = true;
         break;
       }
       default: {
@@ -110,13 +666,100 @@ int main(int argc, char** argv)
   }
 
   int nArgs = argc - optind;
-  if (nArgs < 1 || nArgs > 2) {
+  if (!isWorker &&
+      (nArgs < 1 || (nArgs > 2 && ((nThreads < 0 && nProcesses < 0 && !printReport &&
+                                    !refinePending) || packArrays))))
+  {
     printUsage();
     return EXIT_FAILURE;
   }
 
   ImageBuilder::init();
 
+  int nCores = max(int(thread::hardware_concurrency()), 1);
+
+  // Parallel conversions already keep all cores busy, a single image is split between them.
+  ImageBuilder::setBC7Options(bc7Speed, 1);
+
+  if (isWorker) {
+    int nFailed = Coordinator::serve([dropMipmaps](const JobScheduler::Job& job)
+    {
+      return convert(job.file.c_str(), job.destFile.c_str(), job.options, job.scale, dropMipmaps);
+    });
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (printReport) {
+    bool isSuccessful = TextureReport::print(argv + optind, nArgs, nThreads > 0 ? nThreads : nCores,
+                                             jsonReport);
+    return isSuccessful ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (watchDir) {
+    int nFailed = watch(argv[optind], rulesFile, nThreads > 0 ? nThreads : nCores, memoryBudget);
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (packArrays) {
+    const char* destDir      = nArgs == 2 ? argv[optind + 1] : argv[optind];
+    bool        isSuccessful = ArrayPacker::pack(argv[optind], destDir, ddsOptions, scale,
+                                                 nThreads > 0 ? nThreads : nCores);
+    return isSuccessful ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (!hasWorkers) {
+    Pipeline::defaultWorkers(nThreads > 0 ? nThreads : nCores, nWorkers);
+  }
+
+  unique_ptr<Coordinator> coordinator;
+
+  if (nProcesses >= 0) {
+    // Settings that are not part of jobs are passed to workers on their command line.
+    char workerArgs[128];
+    snprintf(workerArgs, sizeof(workerArgs), "-w -e %d -z %.17g%s", bc7Speed, rdoError,
+             dropMipmaps ? " -d" : "");
+
+    if (workerCommands.empty()) {
+      workerCommands.push_back(shellQuote(argv[0]));
+    }
+
+    coordinator.reset(new Coordinator(workerCommands, workerArgs,
+                                      nProcesses > 0 ? nProcesses : nCores, jobTimeout,
+                                      memoryBudget));
+  }
+
+  if (refinePending) {
+    int nFailed = refineAll(argv + optind, nArgs, dropMipmaps, nThreads > 0 ? nThreads : nCores,
+                            memoryBudget, coordinator.get());
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (progressive) {
+    // Previews and refinements of a single image use all cores for BC7, like normal conversions.
+    bool        isBatch  = nThreads >= 0 || nProcesses >= 0;
+    const char* destFile = !isBatch && nArgs == 2 ? argv[optind + 1] : nullptr;
+
+    ImageBuilder::setBC7Options(bc7Speed, isBatch ? 1 : nCores);
+
+    int nFailed = convertProgressive(argv + optind, isBatch ? nArgs : 1, destFile, ddsOptions,
+                                     scale, dropMipmaps, nWorkers,
+                                     nThreads > 0 ? nThreads : nCores, memoryBudget,
+                                     coordinator.get());
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (textureBudget != 0) {
+    int nFailed = convertBudget(argv[optind], textureBudget, dropMipmaps, nWorkers, memoryBudget,
+                                coordinator.get());
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (nThreads >= 0 || coordinator != nullptr) {
+    int nFailed = convertAll(argv + optind, nArgs, ddsOptions, scale, dropMipmaps, nWorkers,
+                             memoryBudget, coordinator.get());
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   if (printInfo) {
     if (ImageBuilder::printInfo(argv[optind])) {
       return EXIT_SUCCESS;
@@ -127,15 +770,14 @@ int main(int argc, char** argv)
     }
   }
 
-  ImageData image = ImageBuilder::loadImage(argv[optind]);
-
-  if (image.isEmpty()) {
-    printf("Failed to open image '%s'.\n", argv[optind]);
-    return EXIT_FAILURE;
-  }
-
   if (detectNormals) {
-    if (image.isNormalMap()) {
+    ImageData image = ImageBuilder::loadImage(argv[optind]);
+
+    if (image.isEmpty()) {
+      printf("Failed to open image '%s'.\n", argv[optind]);
+      return EXIT_FAILURE;
+    }
+    else if (image.isNormalMap()) {
       printf("Normal map detected.\n");
       return EXIT_SUCCESS;
     }
@@ -144,29 +786,11 @@ int main(int argc, char** argv)
     }
   }
 
-  if (image.flags & ImageData::NORMAL_BIT) {
-    ddsOptions |= ImageBuilder::NORMAL_MAP_BIT;
-    ddsOptions &= ~(ImageBuilder::YYYX_BIT | ImageBuilder::ZYZX_BIT);
-  }
-
-  string destFile;
+  ImageBuilder::setBC7Options(bc7Speed, nCores);
 
-  if (nArgs == 2) {
-    destFile = argv[optind + 1];
-  }
-  else {
-    const char* dot = strrchr(argv[optind], '.');
-
-    if (dot == nullptr) {
-      printf("File extensfion missing: '%s'.\n", argv[optind]);
-      return false;
-    }
-    else {
-      destFile = string(argv[optind], size_t(dot - argv[optind])) + ".dds";
-    }
-  }
+  string destFile = nArgs == 2 ? argv[optind + 1] : destFileFor(argv[optind]);
 
-  if (!ImageBuilder::createDDS(&image, 1, ddsOptions, scale, destFile.c_str())) {
+  if (destFile.empty() || !convert(argv[optind], destFile.c_str(), ddsOptions, scale, dropMipmaps)) {
     return EXIT_FAILURE;
   }
   return EXIT_SUCCESS;